@@ -48,6 +48,27 @@ Protocol description
     The program name has been changed.    
   Apr 12,2022
     Added Faces encoder allows for focus control.
+  Oct 18,2026
+    Added the key engine. Long-press and accelerating auto-repeat of the buttons.
+    The remote sends the button state by "K" message.
+    The lens list is not limited to 15 lenses. It is read from the SD card as needed.
+    Hold A and press C to jump to the next focal length, hold A and press B for the recently used lenses.
+    The numbers in the messages, the lens list and the LED colors are checked. A malformed one is ignored.
+    The aperture and the focus position are drawn by the pre-rendered glyphs, only the changed digits.
+    Bridge mode. (bridgeMode=1) The host on the Bluetooth serial can send "P#", "Mxxxx#" and "Axx#" to the lens controller.
+    Up to 4 lens controllers through a USB hub. (controllers=N) Long-press A in the lens selection selects the next one at the release. A host selects one by "C<index>#".
+    The timed work runs on the timer wheel, nothing waits by delay(). (timerReportMs=N prints the lateness)
+    Fast boot. The screen is drawn first, the Bluetooth starts on the other core, the encoder is probed later.
+    The boot stages are dumped to the serial when the focus position is known, and by "T#" on the serial.
+    The remote draws the focus and the aperture at once, and the requests have the sequence number.
+    The state from the controller older than the request is not drawn. The encoder sends the latest position every 50ms.
+    "S#" on the serial prints the message statistics. burstSession.bin is the burst of the remote for the replay.
+    Heap and stack telemetry. "H#" on the serial prints it, and on the Bluetooth serial replies "H<free> <largest> ...#".
+    The alarm is shown when the free heap, the largest free block or the stack left goes under the threshold.
+    Warm resume. The state is kept over the reset in the RTC memory and on the SD card, and the boot goes
+    back to the aperture or the focus phase without the lens selection, and sets the aperture again. (resume=N)
+    The time of the focus moves of each lens is learned and saved. (lensMotion.txt) "P#" and the commands of the host
+    are held until the move is expected to end, and the end is checked by "P#" at that time. (motionModel=0 is off)
     
 */
 
@@ -61,6 +82,19 @@ Protocol description
 #include "ButtonEx.h"
 #include "BluetoothSerial.h"
 #include "facesEncoder.h"
+#include "keyEngine.h"
+#include "lensLibrary.h"
+#include "sessionRecorder.h"
+#include "tokenizer.h"
+#include "glyphCache.h"
+#include "commandPipeline.h"
+#include "lensPort.h"
+#include "timerWheel.h"
+#include "bootTrace.h"
+#include "memTelemetry.h"
+#include "resumeStore.h"
+#include "lensMotion.h"
+#include "motionStore.h"
 
 int baud = 38400;   // for ASCOM Canon EF Lens Controller
 
@@ -72,10 +106,15 @@ int baud = 38400;   // for ASCOM Canon EF Lens Controller
 
 #define MYINIFILENAME       "/canonLens.ini"
 #define LENSINFOFILENAME    "/Lens.txt"
-#define MAX_LENS        15      // number of lens list
-#define MAX_APERTURE    32      // number of aperture list
-#define QUEUELENGTH     10      // number of commands that can be saved in the serial queue
+#define SESSIONFILENAME     "/session.bin"
+#define RESUMEFILENAME      "/resume%d.bin"   // slots of the checkpoint
+#define MOTIONFILENAME      "/lensMotion.txt" // timing models of the focus moves, by the lens name
+#define QUEUELENGTH     32      // number of commands that can be saved in the serial queue
 #define RECVLINES       32
+#define BTMAXMESSAGE    128     // max length of one message to the remote (longer ones are not sent)
+#define NUMERALFONT     6       // Font of the aperture and the focus position. (digits only)
+#define MAXCONTROLLERS  4       // number of the lens controllers through the USB hub
+#define INIFILELINES    48      // lines of the system settings file
 
 // State machine phase
 #define PHASE_WAIT_USB_CONNECT  0   // Waiting for the lens controller to be connected.
@@ -85,17 +124,22 @@ int baud = 38400;   // for ASCOM Canon EF Lens Controller
 #define PHASE_WAIT_BT_CONNECT   10  // .
 
 #define BATTERYUPDATETIMEMS 2500
+#define PERSERBUDGETUS      3000  // Time allowed for the message processing in one loop.
+#define REMOTEKEYREFRESHMS  200   // Interval the remote resends the held down buttons.
+#define REMOTEKEYTIMEOUTMS  600   // The remote buttons are released when not resent in time.
+#define REMOTEFOCUSMS       50    // Interval the remote sends the position of the encoder.
+#define BRIDGEREPORTMS      10000 // Interval of the bridge statistics to the serial.
+#define BTBEGINSTACK        8192  // Stack of the task starting the Bluetooth serial.
+#define MEMALARMFREE        20000 // Alarm of the free heap. (bytes)
+#define MEMALARMLARGEST     8192  // Alarm of the largest free block. (bytes)
+#define MEMALARMSTACK       512   // Alarm of the stack left of a task. (bytes)
+#define RESUMESAVEMS        2000  // The checkpoint is written to the SD card when the state stays this time.
+#define MOTIONSAVEMS        30000 // The timing models of the lenses are saved when no move is learned this time.
 #define RGB(r,g,b) (int16_t)( b + (g << 5 ) + ( r << 11 ) )
 
-typedef struct {
-  String lines;
-  String lensName;
-  int numberOfAperture;
-  String aperture[MAX_APERTURE];
-} lensInfo_t;
-
 typedef struct {
   int phase;
+  int controllerIndex;    // The lens controller on the display.
   int lensIndex;
   int apertureIndex;
   int focusPosition;
@@ -104,48 +148,106 @@ typedef struct {
   uint8_t macBT[6];
 } systemParameter_t;
 
-// FTDI Async class
-class FTDIAsync : public FTDIAsyncOper {
-  public:
-    bool flagOnInit;
-    uint8_t OnInit( FTDI *pftdi );
-};
-
-uint8_t FTDIAsync::OnInit( FTDI *pftdi ) {
-  uint8_t rcode = 0;
-
-  rcode = pftdi->SetBaudRate( baud );  // for ASCOM Canon EF Lens Controller
-
-  if ( rcode ) {
-    Serial.printf( "rode=%d\n", rcode );
-    ErrorMessage<uint8_t>( PSTR( "SetBaudRate" ), rcode );
-    return rcode;
-  }
-  rcode = pftdi->SetFlowControl( FTDI_SIO_DISABLE_FLOW_CTRL );
-
-  if (rcode){
-    Serial.printf( "rode=%d\n", rcode );
-    ErrorMessage<uint8_t>( PSTR( "SetFlowControl" ), rcode );
-  }
-
-  Serial.println( "OnInit" );
-  flagOnInit = true;
-  return rcode;
-}
-
 // USB settings
 USB              Usb;
-FTDIAsync        FtdiAsync;
-FTDI             Ftdi( &Usb, &FtdiAsync );
-StringQueue queueUSB( QUEUELENGTH );       // receive serial queue of commands
-int recvLineUSBIndex;
-char recvLineUSB[RECVLINES];
+USBHub           Hub( &Usb );   // The lens controllers can be connected through the USB hub.
 
 // BluetoothSerial
 BluetoothSerial SerialBT;
+volatile bool btReady;                    // SerialBT.begin() has finished on the other core.
+volatile unsigned long btReadyUs;
+volatile uint32_t btBeginStackFree;       // Stack high-water mark of the task starting the Bluetooth serial.
+bool btReadyMarked;
 StringQueue queueBT( QUEUELENGTH );       // receive serial queue of commands
 int recvLineBTIndex;
 char recvLineBT[RECVLINES];
+int recvLineSerialIndex;                  // Queries on the serial.
+char recvLineSerial[RECVLINES];
+
+// Message processing statistics
+typedef struct {
+  unsigned long received;   // Frames taken out of the serial.
+  unsigned long processed;  // Frames processed.
+  unsigned long coalesced;  // Frames replaced by a newer frame of the same kind.
+  unsigned long dropped;    // Frames lost because the queue was full.
+  unsigned long deferred;   // Loops that ran out of the time budget with frames left.
+  unsigned long malformed;  // Frames ignored because a field is not a number.
+  unsigned long stale;      // States older than the prediction of the remote, not drawn.
+} perserStat_t;
+
+// Lens controllers
+// The lens, the aperture and the focus of the controller on the display are in the systemParam,
+// and those of the others are kept here.
+typedef struct {
+  LensPort *port;
+  StringQueue *queue;           // receive queue of the replies
+  int recvLineIndex;
+  char recvLine[RECVLINES];
+  CommandPipeline pipeline;     // Commands to the lens controller.
+  perserStat_t stat;
+  bool connected;
+  int lensIndex;
+  int apertureIndex;
+  int focusPosition;
+  int resumeAperture;           // Aperture set at the connection after the resume, or -1.
+  bool initialised;             // The focus position was read back after the connection, and the aperture is set.
+  LensMotion motion;            // Timing model of the focus moves of the lens.
+  int motionTimer;              // Timer of the probe of the move.
+} lensController_t;
+
+// State of the session kept over the reset.
+typedef struct {
+  int32_t phase;
+  int32_t controllerIndex;
+  int32_t lensIndex[MAXCONTROLLERS];
+  int32_t apertureIndex[MAXCONTROLLERS];
+  int32_t focusPosition[MAXCONTROLLERS];
+} resumeState_t;
+
+// Session recorder and replay
+typedef struct {
+  unsigned long records;
+  unsigned long matched;      // Outputs same as the record.
+  unsigned long diverged;     // Outputs different from the record.
+  unsigned long missing;      // Outputs in the record but not produced.
+  unsigned long extra;        // Outputs produced but not in the record.
+  unsigned long phaseDiverged;
+  unsigned long sessionTime;  // Time of the last record.
+  unsigned long startTime;
+  unsigned long loops;
+  unsigned long loopTotalUs;
+  unsigned long loopMaxUs;
+} replayStat_t;
+
+SessionRecorder recorder;
+SessionReplayer replayer;
+bool recordSession;
+String replaySessionFile;
+StringQueue replayExpected( QUEUELENGTH );  // Outputs of the record not compared yet.
+StringQueue replayProduced( QUEUELENGTH );  // Outputs of the replay not compared yet.
+replayStat_t replayStat;
+uint8_t replayKeyMask;
+int16_t replayEncoderPosition;
+int16_t recordedEncoderPosition;
+uint8_t recordedKeyMask;
+int recordedPhase;
+int recordedController;
+int replayController;
+bool replayBTRead;              // receiveBT() is reading the frames of one perser of the record.
+String replayBTOut;             // Message to the remote recorded in the chunks, not completed yet.
+
+// Lens controllers, and the bridge to the host on the Bluetooth serial
+lensController_t controller[MAXCONTROLLERS];
+int numberOfControllers;
+bool simulateControllers;
+bool bridgeMode;
+bool bridgeActive;
+bool bridgeIndexed;             // The host addresses the controllers by "n:".
+unsigned long bridgeReportCommands;
+
+unsigned long perserBudgetUs;
+perserStat_t perserStatBT;
+unsigned long refusedBT;        // Messages to the remote not sent because they are too long.
 
 // Faces Encoder
 facesEncoder encoder;
@@ -158,7 +260,20 @@ ledColorInfo_t ledColorConnect;
 ledColorInfo_t ledColorIndicator1;
 ledColorInfo_t ledColorIndicator10;
 
-unsigned long batteryUpdateTime;
+TimerWheel scheduler;           // Timed work of the loop.
+BootTrace bootTrace;            // Timestamps of the boot stages.
+MemTelemetry memTelemetry;      // Heap and stack telemetry.
+unsigned long memSampleMs;
+ResumeStore resumeStore;        // Checkpoint of the state for the warm resume.
+resumeState_t resumeLast;       // State of the last checkpoint.
+int resumeMode;
+int resumePhase;                // Phase restored when the lens controller is connected.
+int resumeTimer;                // Timer writing the checkpoint to the SD card.
+bool motionModel;               // Learn the time of the moves, and hold the commands while moving.
+MotionStore motionStore;        // Timing models of the lenses on the SD card.
+int motionSaveTimer;
+unsigned long timerReportMs;
+bool indicatorAfterPattern;     // Light the indicator when the pattern of the ring light ends.
 int lastBatteryLevel;
 int numberOfLens;
 int connectBT;
@@ -166,9 +281,29 @@ String myMacBTString;
 systemParameter_t systemParam;
 systemParameter_t compareParam;
 lensInfo_t *selectlensInfo;
-uint8_t virtualKeyMap[3];
 
-lensInfo_t lensInfo[MAX_LENS];
+// Sequence numbers of the requests of the remote
+// The remote draws the result of the request at once (prediction), and the state from
+// the controller is drawn only if it is of the request of the prediction or later.
+uint16_t remoteSeq;             // Controller: the latest sequence number received from the remote.
+bool remoteSequenced;           // Controller: the remote sends the sequence numbers.
+uint16_t requestSeq;            // Remote: the sequence number of the latest request.
+uint16_t focusSeq;              // Remote: the request of the focus drawn.
+uint16_t apertureSeq;           // Remote: the request of the aperture drawn.
+int predictedFocus;
+int focusSendTimer;             // Timer sending the latest position of the encoder.
+unsigned long focusSentTime;
+
+// Key engine
+KeyEngine keyEngine;
+uint8_t remoteKeyMask;          // Buttons held down on the remote.
+unsigned long remoteKeyTime;
+uint8_t latestKeyMask;
+unsigned long latestKeyTime;
+
+LensLibrary lensLibrary;
+GlyphCache glyphCache;          // Glyphs of the aperture and the focus position.
+size_t glyphCacheBytes;
 ButtonEx* buttonScan;
 LabelEx* labelStatus;
 LabelEx* labelLensNameTitle;
@@ -199,12 +334,25 @@ const uint16_t connectRingLitPattern[] = {
 };
        
 void perserUSB( void );
+void perserController( int index, unsigned long startTime );
 void perserBT( void );
+void receiveUSB( void );
+void receiveBT( void );
+void receiveSerial( void );
+void processBT( String replystr );
+void bridgeCommand( int index, int cmd, const char *param );
+void bridgeReply( int index, String replystr );
+uint8_t controllerSend( int index, const char *buff, uint8_t owner );
+uint8_t pumpLensController( int index );
+uint8_t writeLensController( int index, const char *buff, uint8_t owner );
+void sendBT( const char *fmt, ... );
+bool frameCharacter( char inChar, char *recvLine, int *recvLineIndex );
 
 // ---------------------------------------------------------------------------------------------------------
 // DO NOT CHANGE
 //#define DEBUG     1
 //#define DEBUGHPSW 1
+//#define BENCHMARK 1     // Run the microbenchmarks of benchmark.ino at the start.
 
 // ---------------------------------------------------------------------------------------------------------
 // CODE START
@@ -214,26 +362,6 @@ void software_Reboot()
 //  asm volatile ( "jmp 0");        // jump to the start of the program
 }
 
-int argumentSeparatorString( String inString, String *StringList, int separator, int maxElements )
-{
-  int n = 0;
-  int s1;
-  
-  // Parse an inString.
-  while ( inString.length() > 0 ) {
-    s1 = inString.indexOf( separator );  // Find the separator in the string.
-    if ( s1 > 0 ) {
-      StringList[n++] = inString.substring( 0, s1 );
-      inString.remove( 0, s1 + 1 );
-      if ( n >= maxElements ) return n;
-    } else {
-      StringList[n++] = inString;
-      break;          
-    }
-  }
-  return n;
-}
-
 uint8_t atox1( const char *p )
 {
   uint8_t c, d;
@@ -266,47 +394,26 @@ void decodeMacAddressString( String macAddrStr, uint8_t macaddr[6] )
 }
 
 // Load the lens information list from the micro SD card.
+// Only the page index is made here, the lenses are read when they are displayed.
 bool readLensInfoFile( void )
 {
-  IniFiles ini( MAX_LENS );
-  bool validFile = ini.open( SD, LENSINFOFILENAME );
+  memScope_t memScope = memTelemetry.enter( MEM_CONFIG );
+  bool validFile = lensLibrary.open( SD, LENSINFOFILENAME );
+  numberOfLens = lensLibrary.count();
+  memTelemetry.leave( memScope );
 
   Serial.printf( "Open : %s %d\n", LENSINFOFILENAME, validFile );
-
-  numberOfLens = 0;
-  for ( int i = 0; i < MAX_LENS; i++ ) {
-    int s1;
-    String key = "lens" + String( i+1 );
-    String lines = ini.readString( key, "" );
-    lensInfo_t *lensp = &lensInfo[i];
-    s1 = lines.indexOf( '|' );  // Find the separator between the lens name and the aperture string.
-//    Serial.printf( "Line(%s) : %s\n", key.c_str(), lines.c_str() );
-
-    // Parse the lens name and aperture string.
-    if ( s1 > 0 ) {
-      String aLines = lines.substring( 0, s1 ); // cut a lens name of lines.
-      lines.remove( 0, s1 + 1 ); // remove a lens name of lines.
-      aLines.trim();
-      lensp->lensName = aLines;
-      lines.trim();
-      numberOfLens++;
-      Serial.printf( "LensName%d = %s\n", i, lensp->lensName.c_str() );
-      Serial.printf( "Aperture%d = %s\n", i, lines.c_str() );
-
-      // Aperture
-      lensp->numberOfAperture = argumentSeparatorString( lines, lensp->aperture, ' ', MAX_APERTURE );
-      Serial.printf( "numberOfAperture%d = %d\n", i, lensp->numberOfAperture );
-    }
-  }
-
-  ini.close( SD );
-  return true;
+  Serial.printf( "numberOfLens = %d\n", numberOfLens );
+  return validFile;
 }
 
 // Display lens name on the labelLensName.
 void lensSelect( void )
 {
-  selectlensInfo = &lensInfo[systemParam.lensIndex];
+  if ( systemParam.lensIndex < 0 || systemParam.lensIndex >= numberOfLens ) {
+    systemParam.lensIndex = 0;
+  }
+  selectlensInfo = lensLibrary.get( systemParam.lensIndex );
   int clFill = ( systemParam.phase == PHASE_LENS ) ? TFT_BLUE : TFT_BLACK;
   labelLensName->frameRect( TFT_WHITE, clFill, 4 );
   labelLensName->caption( TFT_WHITE, selectlensInfo->lensName );
@@ -339,12 +446,40 @@ void lensSelectPrev( void )
   lensSelect( nsel );
 }
 
+// Jump to the first lens of the next longer focal length.
+void lensSelectNextFocalLength( void )
+{
+  int nsel = lensLibrary.nextFocalLength( systemParam.lensIndex );
+  if ( nsel >= 0 ) {
+    lensSelect( nsel );
+  }
+}
+
+// Move to the next lens of the most recently used list.
+void lensSelectRecent( void )
+{
+  int n;
+  for ( n = 0; n < LENS_RECENT; n++ ) {
+    if ( lensLibrary.recent( n ) == systemParam.lensIndex ) break;
+  }
+  if ( n == LENS_RECENT ) n = -1;   // Not in the list, begin with the most recent one.
+  for ( int i = 1; i <= LENS_RECENT; i++ ) {
+    int nsel = lensLibrary.recent( ( n + i ) % LENS_RECENT );
+    if ( nsel >= 0 ) {
+      lensSelect( nsel );
+      return;
+    }
+  }
+}
+
 // Display aperture name on the labelAperture.
 void apertureSelect( void )
 {
   int clFill = ( systemParam.phase == PHASE_APERTURE ) ? TFT_RED : TFT_BLACK;
-  labelAperture->frameRect( TFT_WHITE, clFill, 4 );
-  labelAperture->caption( TFT_WHITE, selectlensInfo->aperture[systemParam.apertureIndex] );
+  if ( !labelAperture->isFramed( clFill ) ) {
+    labelAperture->frameRect( TFT_WHITE, clFill, 4 );
+  }
+  labelAperture->caption( TFT_WHITE, lensLibrary.aperture( selectlensInfo, systemParam.apertureIndex ) );
 }
 
 // Set the aperture to the index of the argument <sel>
@@ -379,7 +514,9 @@ void apertureSelectPrev( void )
 void focusPosition( void )
 {
   int clFill = ( systemParam.phase == PHASE_FOCUS ) ? TFT_RED : TFT_BLACK;
-  labelFocus->frameRect( TFT_WHITE, clFill, 4 );
+  if ( !labelFocus->isFramed( clFill ) ) {   // The frame is drawn again only when the phase changed.
+    labelFocus->frameRect( TFT_WHITE, clFill, 4 );
+  }
   labelFocus->caption( TFT_WHITE, "%d", systemParam.focusPosition );
 }
 
@@ -398,48 +535,354 @@ void focusPositionIncrease( int incstep )
   focusPosition( nsel );
 }
 
+// Open the lens controllers. The simulated controllers are used for the test without the devices.
+void controllerBegin( void )
+{
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    lensController_t *c = &controller[i];
+    if ( simulateControllers ) {
+      SimulatedPort *port = new SimulatedPort( 5000 );
+      port->connect( 500 * ( i + 1 ) );   // as the USB enumeration through the hub
+      c->port = port;
+    } else {
+      c->port = new FtdiPort( &Usb, baud );
+    }
+    c->queue = new StringQueue( QUEUELENGTH );
+    c->recvLineIndex = 0;
+    memset( c->recvLine, 0, RECVLINES );
+    memset( &c->stat, 0, sizeof( c->stat ) );
+    c->connected = false;
+    c->apertureIndex = 0;
+    c->focusPosition = 0;
+    c->resumeAperture = -1;
+    c->initialised = false;
+    c->motionTimer = TIMER_NONE;
+  }
+}
+
+// Check the connection of each lens controller.
+// The first controller connected ends the waiting, the others are connected at any time.
+void controllerTask( void )
+{
+  if ( replayer.isReplaying() ) return;   // The replay gives the connection.
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    bool ready = controller[i].port->isReady();
+    if ( ready && !controller[i].connected ) {
+      controllerConnect( i );
+    } else if ( !ready && controller[i].connected ) {
+      Serial.printf( "Controller %d disconnected\n", i );
+      controller[i].connected = false;
+      controller[i].pipeline.clear();
+      controller[i].motion.stop();
+      scheduler.stop( controller[i].motionTimer );
+      controllerStatus();
+    }
+  }
+}
+
+// The lens controller of the <index> is connected. Get the focus position.
+void controllerConnect( int index )
+{
+  if ( !bootTrace.isFinished() ) {
+    bootTrace.mark( "controller" );
+  }
+  controller[index].connected = true;
+  controller[index].initialised = false;
+  recordController( index );
+  recorder.record( REC_CONNECT, "U" );
+  controllerStatus();
+  controllerSend( index, "P#", CMD_LOCAL );
+  if ( systemParam.phase == PHASE_WAIT_USB_CONNECT ) {
+    if ( resumePhase != PHASE_WAIT_USB_CONNECT ) {
+      resumeDisplay();    // Back to the phase before the reset.
+    } else {
+      systemParam.phase = PHASE_LENS;
+    }
+  }
+}
+
+// Show the lens controller on the display and the connected controllers.
+void controllerStatus( void )
+{
+  if ( numberOfControllers <= 1 ) {
+    String USB_STATUS;
+    USB_STATUS = "USB FTDI CDC Baud Rate:" + String( baud ) + "bps";
+    labelStatus->caption( TFT_YELLOW, USB_STATUS );
+    return;
+  }
+  int connected = 0;
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    if ( controller[i].connected ) connected++;
+  }
+  labelStatus->caption( controller[systemParam.controllerIndex].connected ? TFT_YELLOW : TFT_RED,
+                        "Controller %d of %d, %d connected", systemParam.controllerIndex + 1, numberOfControllers, connected );
+}
+
+// The focus position of the controller. The one on the display is in the systemParam.
+int *controllerFocus( int index )
+{
+  return ( index == systemParam.controllerIndex ) ? &systemParam.focusPosition : &controller[index].focusPosition;
+}
+
+// The lens index of the controller, for the system settings.
+int controllerLensIndex( int index )
+{
+  return ( index == systemParam.controllerIndex ) ? systemParam.lensIndex : controller[index].lensIndex;
+}
+
+// Show the lens controller of the <index> on the display.
+// The lens, the aperture and the focus are swapped with the controller on the display.
+void controllerSelect( int index )
+{
+  if ( index < 0 || index >= numberOfControllers || index == systemParam.controllerIndex ) return;
+  lensController_t *c = &controller[systemParam.controllerIndex];
+  c->lensIndex = systemParam.lensIndex;
+  c->apertureIndex = systemParam.apertureIndex;
+  c->focusPosition = systemParam.focusPosition;
+
+  systemParam.controllerIndex = index;
+  c = &controller[index];
+  systemParam.lensIndex = c->lensIndex;
+  systemParam.apertureIndex = c->apertureIndex;
+  systemParam.focusPosition = c->focusPosition;
+  lensSelect();
+  // The aperture and the focus are shown in the aperture and the focus adjustment, and in the lens selection once decided.
+  if ( systemParam.phase == PHASE_APERTURE || systemParam.phase == PHASE_FOCUS || labelFocus->isFramed( TFT_BLACK ) ) {
+    apertureSelect();
+    focusPosition();
+  }
+  controllerStatus();
+  if ( connectBT ) {
+    sendBT( "C%d %d#", systemParam.controllerIndex, numberOfControllers );
+    sendRemote( "P%d %d %d %d#", systemParam.phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
+  }
+}
+
+// Queue the command of the local UI to the lens controller on the display.
+// The command is sent at once unless the reply of "P#" is awaited.
+uint8_t sendLensController( const char *buff )
+{
+  return controllerSend( systemParam.controllerIndex, buff, CMD_LOCAL );
+}
+
+// Queue the command of the <owner> to the lens controller of the <index>.
+// Each controller has its own queue, so a controller waiting for the reply does not delay the others.
+uint8_t controllerSend( int index, const char *buff, uint8_t owner )
+{
+  controller[index].pipeline.push( buff, owner );
+  return pumpLensController( index );
+}
+
+// Send the queued commands to the lens controller as far as possible.
+uint8_t pumpLensController( int index )
+{
+  CommandPipeline *pipeline = &controller[index].pipeline;
+  uint8_t rcode = 0;
+  while ( pipeline->ready( micros() ) ) {
+    const lensCommand_t *cmd = pipeline->front();
+    rcode = writeLensController( index, cmd->command, cmd->owner );
+    motionSent( index, cmd );
+    pipeline->sent( micros() );
+  }
+  return rcode;
+}
+
+// Write the command to the lens controller.
+// The command to the controller 1 and after is shown as "n:<command>" on the serial and in the replay.
+// The probe of the move is not recorded, because the replay does not learn the moves.
+uint8_t writeLensController( int index, const char *buff, uint8_t owner )
+{
+  char label[REC_MAXDATA + 4];
+  controllerLabel( index, buff, label );
+  Serial.printf( ">%s\n", label );
+  if ( owner != CMD_MOTION ) {
+    recordController( index );
+    recorder.record( REC_USB_OUT, buff );
+  }
+  if ( replayer.isReplaying() ) {
+    replayOutput( 'U', label );
+    return 0;
+  }
+  return controller[index].port->send( buff );
+}
+
+// Make the <label> of the frame of the controller. The controller 0 has no prefix.
+void controllerLabel( int index, const char *buff, char *label )
+{
+  if ( index == 0 ) {
+    sprintf( label, "%s", buff );
+  } else {
+    sprintf( label, "%d:%s", index, buff );
+  }
+}
+
+// Record the controller of the following frames, when it is changed.
+void recordController( int index )
+{
+  if ( index != recordedController ) {
+    uint8_t n = index;
+    recorder.record( REC_CONTROLLER, &n, 1 );
+    recordedController = index;
+  }
+}
+
+// Send the message to the Bluetooth serial.
+// A message longer than BTMAXMESSAGE is not sent at all, because a truncated one loses the '#'.
+void sendBT( const char *fmt, ... )
+{
+  va_list ap;
+  char buff[BTMAXMESSAGE];
+
+  va_start( ap, fmt );
+  int length = vsnprintf( buff, sizeof( buff ), fmt, ap );
+  va_end( ap );
+  if ( length >= (int)sizeof( buff ) ) {
+    refuseBT( buff, length );
+    return;
+  }
+  recordBT( buff, length );
+  if ( replayer.isReplaying() ) {
+    replayOutput( 'B', buff );
+    return;
+  }
+  if ( !btReady ) return;   // Nobody is connected yet.
+  SerialBT.print( buff );
+}
+
+// Send the state to the remote. When the remote sends the sequence numbers,
+// the number of the latest request is added, so the remote can tell the state of its prediction.
+void sendRemote( const char *fmt, ... )
+{
+  va_list ap;
+  char buff[BTMAXMESSAGE];
+
+  va_start( ap, fmt );
+  int length = vsnprintf( buff, sizeof( buff ), fmt, ap );
+  va_end( ap );
+  if ( length < (int)sizeof( buff ) && remoteSequenced && length > 0 && buff[length - 1] == '#' ) {
+    length = ( length - 1 ) + snprintf( &buff[length - 1], sizeof( buff ) - ( length - 1 ), " %u#", remoteSeq );
+  }
+  if ( length >= (int)sizeof( buff ) ) {
+    refuseBT( buff, length );
+    return;
+  }
+  sendBT( "%s", buff );
+}
+
+// Count and show the message which is too long to send.
+void refuseBT( const char *buff, int length )
+{
+  refusedBT++;
+  Serial.printf( "BT message of %d bytes refused: %.16s...\n", length, buff );
+}
+
+// Record the message to the remote. A message longer than one record is recorded in the chunks,
+// and a chunk shorter than REC_MAXDATA (empty if needed) ends the message.
+void recordBT( const char *buff, int length )
+{
+  int offset = 0;
+  int chunk;
+  do {
+    chunk = ( length - offset > REC_MAXDATA ) ? REC_MAXDATA : length - offset;
+    recorder.record( REC_BT_OUT, &buff[offset], chunk );
+    offset += chunk;
+  } while ( chunk == REC_MAXDATA );
+}
+
 // Send aperture setting commands to the lens controller.
 uint8_t setApertureValue( int index )
 {
-  uint8_t  rcode;
   char buff[16];
 
   sprintf( buff, "A%02d#", index );  
-  Serial.printf( ">%s\n", buff );
-  rcode = Ftdi.SndData( strlen( buff ), (uint8_t*)buff );
-  return rcode;
+  return sendLensController( buff );
 }
 
 // Send focus position setting commands to the lens controller.
 uint8_t setFocusPosition( int position )
 {
-  uint8_t  rcode;
   char buff[16];
 
   sprintf( buff, "M%d#", position );  
-  Serial.printf( ">%s\n", buff );
-  rcode = Ftdi.SndData( strlen( buff ), (uint8_t*)buff );
-  return rcode;
+  return sendLensController( buff );
+}
+
+// Parse the LED color "<red> <green> <blue>". Each of them is 0 to 255.
+// Returns false if the color is malformed, and the <color> is not changed.
+bool parseLedColor( const char *colorStr, ledColorInfo_t *color )
+{
+  Tokenizer tokens( colorStr, ' ' );
+  int red, green, blue;
+  if ( !tokens.nextInt( &red ) || !tokens.nextInt( &green ) || !tokens.nextInt( &blue ) || !tokens.atEnd() ) return false;
+  if ( red < 0 || red > 255 || green < 0 || green > 255 || blue < 0 || blue > 255 ) return false;
+  color->colorRed = red;
+  color->colorGreen = green;
+  color->colorBlue = blue;
+  return true;
+}
+
+// Read the LED color of the <key>. The <defaultval> is used if it is malformed.
+void readLedColor( IniFiles &ini, const char *key, const char *defaultval, ledColorInfo_t *color )
+{
+  String colorStr = ini.readString( key, defaultval );
+  if ( !parseLedColor( colorStr.c_str(), color ) ) {
+    Serial.printf( "%s=%s is malformed\n", key, colorStr.c_str() );
+    parseLedColor( defaultval, color );
+  }
 }
 
 // Save the system settings to the micro SD card.
 bool writeSystemFile( void )
 {
-  IniFiles ini( 16 );
-  bool validFile = ini.open( SD, MYINIFILENAME );
-  ini.writeInteger( "LensIndex", systemParam.lensIndex );
-//  ini.writeInteger( "ApertureIndex", systemParam.apertureIndex );
-  ini.close( SD );
+  memScope_t memScope = memTelemetry.enter( MEM_CONFIG );
+  bool validFile;
+  {
+    IniFiles ini( INIFILELINES );
+    validFile = ini.open( SD, MYINIFILENAME );
+    ini.writeInteger( "LensIndex", controllerLensIndex( 0 ) );
+    for ( int i = 1; i < numberOfControllers; i++ ) {
+      ini.writeInteger( "LensIndex" + String( i ), controllerLensIndex( i ) );
+    }
+    ini.writeString( "LensRecent", lensLibrary.recentString() );
+//    ini.writeInteger( "ApertureIndex", systemParam.apertureIndex );
+    ini.close( SD );
+  }   // The lines of the file are freed here.
+  memTelemetry.leave( memScope );
+  motionSave();
   return validFile;
 }
 
 // Load the system settings from the micro SD card.
 bool readSystemFile( void )
 {
-  IniFiles ini( 16 );
+  IniFiles ini( INIFILELINES );
   bool validFile = ini.open( SD, MYINIFILENAME );
   systemParam.lensIndex = ini.readInteger( "LensIndex", 0 );
   systemParam.apertureIndex = ini.readInteger( "ApertureIndex", 0 );
+  systemParam.controllerIndex = 0;
+
+  // controllers=N uses N lens controllers through the USB hub. (1 to MAXCONTROLLERS)
+  // The lens of the controller n is LensIndex<n>. simulateControllers=1 simulates the controllers.
+  numberOfControllers = ini.readInteger( "controllers", 1 );
+  if ( numberOfControllers < 1 || numberOfControllers > MAXCONTROLLERS ) {
+    numberOfControllers = 1;
+  }
+  simulateControllers = ini.readInteger( "simulateControllers", 0 );
+  // resume=1 goes back to the state before the reset, except the power on. resume=2 also after the power on.
+  // (0 is off) The state is kept in RESUMEFILENAME on the SD card.
+  resumeMode = ini.readInteger( "resume", 1 );
+  // motionModel=0 does not learn the time of the focus moves. The models are in lensMotion.txt.
+  motionModel = ini.readInteger( "motionModel", 1 );
+  controller[0].lensIndex = systemParam.lensIndex;
+  for ( int i = 1; i < numberOfControllers; i++ ) {
+    controller[i].lensIndex = ini.readInteger( "LensIndex" + String( i ), 0 );
+  }
+  lensLibrary.setRecentString( ini.readString( "LensRecent", "" ) );
+
+  // recordSession=1 records the session to SESSIONFILENAME.
+  // replaySession=<file name> replays the recorded session instead.
+  recordSession = ini.readInteger( "recordSession", 0 );
+  replaySessionFile = ini.readString( "replaySession", "" );
 
   // If you want to run as a remote control, please write the mac address of the connection destination.
   // macBT=XX:XX:XX:XX:XX:XX
@@ -452,27 +895,27 @@ bool readSystemFile( void )
     systemParam.remoconMode = 0;
   }
 
-  String paramString;
-  String paramStringList[3];
-  int nParam;
-  
-  paramString = ini.readString( "ledColorConnect", "0 0 255" );
-  nParam = argumentSeparatorString( paramString, paramStringList, ' ', 3 );
-  ledColorConnect.colorRed = paramStringList[0].toInt();
-  ledColorConnect.colorGreen = paramStringList[1].toInt();
-  ledColorConnect.colorBlue = paramStringList[2].toInt();
-
-  paramString = ini.readString( "ledColorIndicator1", "0 64 0" );
-  nParam = argumentSeparatorString( paramString, paramStringList, ' ', 3 );
-  ledColorIndicator1.colorRed = paramStringList[0].toInt();
-  ledColorIndicator1.colorGreen = paramStringList[1].toInt();
-  ledColorIndicator1.colorBlue = paramStringList[2].toInt();
-
-  paramString = ini.readString( "ledColorIndicator10", "64 0 0" );
-  nParam = argumentSeparatorString( paramString, paramStringList, ' ', 3 );
-  ledColorIndicator10.colorRed = paramStringList[0].toInt();
-  ledColorIndicator10.colorGreen = paramStringList[1].toInt();
-  ledColorIndicator10.colorBlue = paramStringList[2].toInt();
+  readLedColor( ini, "ledColorConnect", "0 0 255", &ledColorConnect );
+  readLedColor( ini, "ledColorIndicator1", "0 64 0", &ledColorIndicator1 );
+  readLedColor( ini, "ledColorIndicator10", "64 0 0", &ledColorIndicator10 );
+
+  perserBudgetUs = ini.readInteger( "perserBudgetUs", PERSERBUDGETUS );
+  // bridgeMode=1 passes "P#", "Mxxxx#" and "Axx#" of the host on the Bluetooth serial to the lens controller.
+  bridgeMode = ini.readInteger( "bridgeMode", 0 );
+  // glyphCacheBytes=0 draws the aperture and the focus position by the font.
+  glyphCacheBytes = ini.readInteger( "glyphCacheBytes", GLYPH_MAXBYTES );
+  // timerReportMs=N prints the lateness of the timers every N ms. (0 is off)
+  timerReportMs = ini.readInteger( "timerReportMs", 0 );
+  // The heap and the stacks are sampled every memSampleMs, and kept in the history every memHistoryMs.
+  // The alarm is raised under memAlarmFree, memAlarmLargest (largest free block) or memAlarmStack bytes. (0 is off)
+  memSampleMs = ini.readInteger( "memSampleMs", MEM_SAMPLEMS );
+  memTelemetry.begin( ini.readInteger( "memHistoryMs", MEM_HISTORYMS ),
+                      ini.readInteger( "memAlarmFree", MEMALARMFREE ),
+                      ini.readInteger( "memAlarmLargest", MEMALARMLARGEST ),
+                      ini.readInteger( "memAlarmStack", MEMALARMSTACK ) );
+  keyEngine.setTiming( ini.readInteger( "keyLongPressMs", KEY_LONGPRESSMS ),
+                       ini.readInteger( "keyRepeatDelayMs", KEY_REPEATDELAYMS ),
+                       KEY_REPEATSLOWMS, KEY_REPEATFASTMS );
 
   ini.close( SD );
 
@@ -508,11 +951,11 @@ void selectLensDisplay( void )
   labelApertureTitle->caption( TFT_GREEN, "Aperture" );
   labelAperture->frameRect( TFT_WHITE, TFT_RED, 4 );
   labelAperture->alignment = taCenter;
-  labelAperture->textSize = 6;
+  labelAperture->textSize = NUMERALFONT;
   labelAperture->textBaseOffset = -4;
   labelFocus->frameRect( TFT_WHITE, TFT_RED, 4 );
   labelFocus->alignment = taRightJustify;
-  labelFocus->textSize = 6;
+  labelFocus->textSize = NUMERALFONT;
   labelFocus->textBaseOffset = -4;
 }
 
@@ -524,6 +967,189 @@ void lightIndicator( void )
     encoder.ringLight( currentLightIndicator, ledColorIndicator10 );
   }
 }
+// Returns the key mask of the M5Stack buttons held down.
+uint8_t readKeyMask( void )
+{
+  if ( replayer.isReplaying() ) return replayKeyMask;
+  uint8_t keyMask = 0;
+  if ( M5.BtnA.isPressed() ) keyMask |= KEYBIT_A;
+  if ( M5.BtnB.isPressed() ) keyMask |= KEYBIT_B;
+  if ( M5.BtnC.isPressed() ) keyMask |= KEYBIT_C;
+  if ( keyMask != recordedKeyMask ) {
+    recorder.record( REC_KEYMASK, &keyMask, 1 );
+    recordedKeyMask = keyMask;
+  }
+  return keyMask;
+}
+
+// Returns the position of the faces encoder.
+int16_t readEncoderPosition( void )
+{
+  if ( replayer.isReplaying() ) return replayEncoderPosition;
+  int16_t position = encoder.getCurrentPosition();
+  if ( position != recordedEncoderPosition ) {
+    recorder.record( REC_ENCODER, &position, sizeof( position ) );
+    recordedEncoderPosition = position;
+  }
+  return position;
+}
+
+// --- Key handlers
+// Lens decided, go to the aperture selection.
+void keyLensDecide( const keyEvent_t *event )
+{
+  systemParam.phase = PHASE_APERTURE;
+  selectLensDisplay();
+  lensSelect();
+  apertureSelect( 0 );
+  focusPosition();
+  lensLibrary.touch( systemParam.lensIndex );
+  writeSystemFile();
+  motionLoad();
+  sendRemote( "P%d %d %d %d#", systemParam.phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
+}
+
+void keyLensNext( const keyEvent_t *event )
+{
+  lensSelectNext();
+  if ( connectBT ) {
+    sendRemote( "L%d %d#", systemParam.phase, systemParam.lensIndex );
+  }
+}
+
+void keyLensPrev( const keyEvent_t *event )
+{
+  lensSelectPrev();
+  if ( connectBT ) {
+    sendRemote( "L%d %d#", systemParam.phase, systemParam.lensIndex );
+  }
+}
+
+// Hold the A button and press C, jump to the next focal length.
+void keyLensNextFocalLength( const keyEvent_t *event )
+{
+  lensSelectNextFocalLength();
+  if ( connectBT ) {
+    sendRemote( "L%d %d#", systemParam.phase, systemParam.lensIndex );
+  }
+}
+
+// Hold the A button and press B, select the recently used lenses in turn.
+void keyLensRecent( const keyEvent_t *event )
+{
+  lensSelectRecent();
+  if ( connectBT ) {
+    sendRemote( "L%d %d#", systemParam.phase, systemParam.lensIndex );
+  }
+}
+
+// Return to the lens selection by long-press of the A button.
+void keyLensReselect( const keyEvent_t *event )
+{
+  systemParam.phase = PHASE_LENS;
+  labelLensNameTitle->caption( TFT_GREEN, "Lens" );
+  labelApertureTitle->caption( TFT_WHITE, "Aperture" );
+  labelFocusTitle->caption( TFT_WHITE, "Focus" );
+  apertureSelect();
+  focusPosition();
+  lensSelect();
+  sendRemote( "P%d %d %d %d#", systemParam.phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
+}
+
+// Select the next lens controller by long-press of the A button in the lens selection.
+// It is taken at the release, so holding A for the chords of A and B or C does not select.
+void keyControllerNext( const keyEvent_t *event )
+{
+  controllerSelect( ( systemParam.controllerIndex + 1 ) % numberOfControllers );
+}
+
+// Aperture decided, go to the focus adjustment.
+void keyApertureDecide( const keyEvent_t *event )
+{
+  systemParam.phase = PHASE_FOCUS;
+  labelApertureTitle->caption( TFT_WHITE, "Aperture" );
+  labelFocusTitle->caption( TFT_GREEN, "Focus" );
+  apertureSelect();
+  focusPosition();
+  if ( connectBT ) {
+    sendRemote( "F%d %d#", systemParam.phase, systemParam.focusPosition );
+  }
+}
+
+void keyApertureNext( const keyEvent_t *event )
+{
+  apertureSelectNext();
+  if ( connectBT ) {
+    sendRemote( "A%d %d#", systemParam.phase, systemParam.apertureIndex );
+  }
+}
+
+void keyAperturePrev( const keyEvent_t *event )
+{
+  apertureSelectPrev();
+  if ( connectBT ) {
+    sendRemote( "A%d %d#", systemParam.phase, systemParam.apertureIndex );
+  }
+}
+
+// Focus decided, go back to the aperture selection.
+void keyFocusDecide( const keyEvent_t *event )
+{
+  systemParam.phase = PHASE_APERTURE;
+  labelFocusTitle->caption( TFT_WHITE, "Focus" );
+  labelApertureTitle->caption( TFT_GREEN, "Aperture" );
+  focusPosition();
+  apertureSelect();
+  if ( connectBT ) {
+    sendRemote( "A%d %d#", systemParam.phase, systemParam.apertureIndex );
+  }
+}
+
+// The chord with the A button moves the focus 10 times.
+// The auto-repeat accelerates by the magnitude of the event.
+void keyFocusIncrease( const keyEvent_t *event, int direction )
+{
+  int step = ( event->modifier == KEY_NONE ) ? 1 : 10;
+  focusPositionIncrease( direction * step * event->magnitude );
+  if ( connectBT ) {
+    sendRemote( "F%d %d#", systemParam.phase, systemParam.focusPosition );
+  }
+}
+
+void keyFocusFar( const keyEvent_t *event )
+{
+  keyFocusIncrease( event, +1 );
+}
+
+void keyFocusNear( const keyEvent_t *event )
+{
+  keyFocusIncrease( event, -1 );
+}
+
+#define KEY_EVENT_STEP  ( KEY_EVENT_PRESS | KEY_EVENT_REPEAT )
+
+// Key bindings of each phase.
+const keyBinding_t keyBindings[] = {
+  // phase          key    modifier  event                 handler
+  { PHASE_LENS,     KEY_A, KEY_NONE, KEY_EVENT_CLICK,      keyLensDecide },
+  { PHASE_LENS,     KEY_A, KEY_NONE, KEY_EVENT_LONGCLICK,  keyControllerNext },
+  { PHASE_LENS,     KEY_C, KEY_NONE, KEY_EVENT_STEP,       keyLensNext },
+  { PHASE_LENS,     KEY_B, KEY_NONE, KEY_EVENT_STEP,       keyLensPrev },
+  { PHASE_LENS,     KEY_C, KEY_A,    KEY_EVENT_PRESS,      keyLensNextFocalLength },
+  { PHASE_LENS,     KEY_B, KEY_A,    KEY_EVENT_PRESS,      keyLensRecent },
+  { PHASE_APERTURE, KEY_A, KEY_NONE, KEY_EVENT_CLICK,      keyApertureDecide },
+  { PHASE_APERTURE, KEY_A, KEY_NONE, KEY_EVENT_LONGPRESS,  keyLensReselect },
+  { PHASE_APERTURE, KEY_C, KEY_NONE, KEY_EVENT_STEP,       keyApertureNext },
+  { PHASE_APERTURE, KEY_B, KEY_NONE, KEY_EVENT_STEP,       keyAperturePrev },
+  { PHASE_FOCUS,    KEY_A, KEY_NONE, KEY_EVENT_CLICK,      keyFocusDecide },
+  { PHASE_FOCUS,    KEY_A, KEY_NONE, KEY_EVENT_LONGPRESS,  keyLensReselect },
+  { PHASE_FOCUS,    KEY_C, KEY_NONE, KEY_EVENT_STEP,       keyFocusFar },
+  { PHASE_FOCUS,    KEY_B, KEY_NONE, KEY_EVENT_STEP,       keyFocusNear },
+  { PHASE_FOCUS,    KEY_A, KEY_C,    KEY_EVENT_STEP,       keyFocusFar },
+  { PHASE_FOCUS,    KEY_A, KEY_B,    KEY_EVENT_STEP,       keyFocusNear },
+};
+#define NUMBER_OF_KEYBINDINGS ( sizeof( keyBindings ) / sizeof( keyBindings[0] ) )
+
 // --- Functions that are no longer used
 // Get the battery information of the M5Stack.
 #if 0
@@ -544,47 +1170,406 @@ int8_t getBatteryLevel( void )
 }
 #endif
 
-// Setup
-/*************************************************************************
- * NAME  setup - 
- * SYNOPSIS
- *
- *    void setup( void )
- *
- * DESCRIPTION
- *  
- *************************************************************************/
-void setup()
+// --- Timer handlers
+// Battery indicator.
+// refererd by ProgramResource.net. Thanks ねふぁさん
+void batteryTask( void *arg )
 {
-  // initialize the M5Stack object
-  M5.begin( true, true, true, true );
-  M5.Power.begin();
-  Wire.begin();
+  if ( systemParam.remoconMode || replayer.isReplaying() ) return;
+  if ( M5.Power.canControl() ) {
+    int batteryLevel = M5.Power.getBatteryLevel();
+    if ( lastBatteryLevel != batteryLevel ) {
+      // Rewrite only when the battery state changes.
+      indicateBatteryLevel( batteryLevel );
+      lastBatteryLevel = batteryLevel;
+      if ( connectBT ) {
+        sendBT( "V%d#", batteryLevel );
+      }
+    }
+  }
+}
 
+// Probe the faces encoder after the boot. It is used only by the remote.
+void encoderProbeTask( void *arg )
+{
   useEncoder = encoder.check();
   if ( useEncoder ) {
     Serial.printf( "Faces encoder connected.\n" );
+    scheduler.every( "ringLight", RINGLIGHT_INTERVALMS, encoderLightTask, NULL );
   } else {
     Serial.printf( "Faces encoder not recognized.\n" );
   }
-  
-  latestEncoderPosition = 0;
-  latestButtonStatus = false;
-  batteryUpdateTime = 0;
-  lastBatteryLevel = 0;
-  recvLineUSBIndex = 0;
-  recvLineBTIndex = 0;
-  connectBT = 0;
-  virtualKeyMap[0] = virtualKeyMap[1] = virtualKeyMap[2] = 0;
+  bootTrace.mark( "encoder" );
+}
 
-  FtdiAsync.flagOnInit = false;
-  Serial.printf( "Start\n" );
-  if ( M5.Power.canControl() ) {
-    Serial.printf( "BatteryLevel = %d\n", M5.Power.getBatteryLevel() );
+// Start the Bluetooth serial. The task on the other core, started by setup().
+void btBeginTask( void *arg )
+{
+  if ( systemParam.remoconMode ) {
+    SerialBT.begin( "M5StackCLC", true ); // I am Host. Bluetooth device name
   } else {
-    Serial.printf( "Battery control is not supported.\n" );
+    SerialBT.begin( "M5StackCLC" ); // I am Devuce. Bluetooth device name
   }
-    
+  btReadyUs = micros();
+  btBeginStackFree = uxTaskGetStackHighWaterMark( NULL );
+  btReady = true;
+  vTaskDelete( NULL );
+}
+
+// The boot is usable when the focus position is known. Dump the boot stages.
+void bootFinish( const char *stage )
+{
+  if ( !bootTrace.finish( stage ) ) return;
+  Serial.printf( "Boot %lu ms to %s\n", bootTrace.elapsedUs() / 1000, stage );
+  bootTrace.dump();
+}
+
+// Write the ring light of the faces encoder one LED at a time, and play the pattern.
+void encoderLightTask( void *arg )
+{
+  if ( !encoder.ringLightTask( millis() ) && indicatorAfterPattern ) {
+    indicatorAfterPattern = false;
+    lightIndicator();
+  }
+}
+
+// Print the lateness of the timers to the serial.
+void timerReport( void *arg )
+{
+  scheduler.report();
+}
+
+// Sample the heap and the stacks, and show the alarm raised.
+void memoryTask( void *arg )
+{
+  uint8_t raised = memTelemetry.sample( millis() );
+  if ( raised ) {
+    Serial.printf( "Memory alarm 0x%02X free=%u largest=%u stack=%u (%s)\n", raised, (unsigned)memTelemetry.freeBytes,
+                   (unsigned)memTelemetry.largest, (unsigned)memTelemetry.stackMin, memTelemetry.stackMinName );
+    labelStatus->caption( TFT_RED, "Memory low free %u largest %u", (unsigned)memTelemetry.freeBytes, (unsigned)memTelemetry.largest );
+  }
+}
+
+// Start the timed work of the loop.
+void startTimers( void )
+{
+  // Battery indicator of BATTERYUPDATETIMEMS interval.
+  scheduler.start( "battery", 0, BATTERYUPDATETIMEMS, batteryTask, NULL );
+  scheduler.once( "encoder", 0, encoderProbeTask, NULL );
+  if ( bridgeMode ) {
+    scheduler.every( "bridge", BRIDGEREPORTMS, bridgeReport, NULL );
+  }
+  if ( timerReportMs > 0 ) {
+    scheduler.every( "timerReport", timerReportMs, timerReport, NULL );
+  }
+  if ( memSampleMs > 0 ) {
+    scheduler.start( "memory", 0, memSampleMs, memoryTask, NULL );
+  }
+}
+
+// --- Warm resume
+// The state of the session for the checkpoint.
+void resumeCapture( resumeState_t *state )
+{
+  memset( state, 0, sizeof( *state ) );
+  state->phase = systemParam.phase;
+  state->controllerIndex = systemParam.controllerIndex;
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    state->lensIndex[i] = controllerLensIndex( i );
+    state->apertureIndex[i] = ( i == systemParam.controllerIndex ) ? systemParam.apertureIndex : controller[i].apertureIndex;
+    state->focusPosition[i] = *controllerFocus( i );
+  }
+}
+
+/*************************************************************************
+ * NAME  resumeBegin -
+ *
+ * SYNOPSIS
+ *
+ *    void resumeBegin( void )
+ *
+ * DESCRIPTION
+ *  Load the checkpoint of the session before the reset, called by setup()
+ *  after the lens list is opened. The lenses, the apertures and the focus
+ *  positions of the controllers are restored, and the phase of the aperture
+ *  or the focus is restored when the lens controller is connected.
+ *  The checkpoint with a lens or an aperture out of the list is not used.
+ *************************************************************************/
+void resumeBegin( void )
+{
+  resumeState_t state;
+
+  resumeStore.begin( RESUMEFILENAME );
+  if ( resumeMode == 0 || systemParam.remoconMode || replaySessionFile != "" ) return;
+  // The slots are read also when the state is not used, so the checkpoints of this session go on
+  // after the newest one, and a slot left by the session before is never taken as newer.
+  int source = resumeStore.load( SD, &state, sizeof( state ) );
+  esp_reset_reason_t reason = esp_reset_reason();
+  if ( reason == ESP_RST_POWERON && resumeMode < 2 ) return;
+  if ( source == RESUME_NONE ) return;
+
+  if ( state.controllerIndex < 0 || state.controllerIndex >= numberOfControllers ) return;
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    if ( state.lensIndex[i] < 0 || state.lensIndex[i] >= numberOfLens ) return;
+    if ( state.apertureIndex[i] < 0 || state.apertureIndex[i] >= lensLibrary.get( state.lensIndex[i] )->numberOfAperture ) return;
+  }
+  bool phaseKept = ( state.phase == PHASE_APERTURE || state.phase == PHASE_FOCUS );
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    controller[i].lensIndex = state.lensIndex[i];
+    controller[i].apertureIndex = state.apertureIndex[i];
+    controller[i].focusPosition = state.focusPosition[i];
+    controller[i].resumeAperture = phaseKept ? state.apertureIndex[i] : -1;
+  }
+  int index = state.controllerIndex;
+  systemParam.controllerIndex = index;
+  systemParam.lensIndex = state.lensIndex[index];
+  systemParam.apertureIndex = state.apertureIndex[index];
+  systemParam.focusPosition = state.focusPosition[index];
+  if ( phaseKept ) {
+    resumePhase = state.phase;
+    labelStatus->caption( TFT_YELLOW, "Resume, waiting for the lens controller to be connected." );
+  }
+  resumeLast = state;
+  Serial.printf( "Resume from %s (reset %d) phase %d lens %d aperture %d focus %d\n", ( source == RESUME_RTC ) ? "RTC" : "SD",
+                 reason, state.phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
+  bootTrace.mark( "resume" );
+}
+
+// Back to the phase of the checkpoint when the lens controller is connected. The lens selection is skipped.
+// The aperture is set by the reply of "P#", and the focus position is the one read.
+void resumeDisplay( void )
+{
+  systemParam.phase = resumePhase;
+  resumePhase = PHASE_WAIT_USB_CONNECT;
+  selectLensDisplay();
+  lensSelect();
+  labelApertureTitle->caption( ( systemParam.phase == PHASE_APERTURE ) ? TFT_GREEN : TFT_WHITE, "Aperture" );
+  labelFocusTitle->caption( ( systemParam.phase == PHASE_FOCUS ) ? TFT_GREEN : TFT_WHITE, "Focus" );
+  apertureSelect();
+  focusPosition();
+  if ( connectBT ) {
+    sendRemote( "P%d %d %d %d#", systemParam.phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
+  }
+}
+
+// Save the state to the RTC memory when it is changed, called by the loop.
+// The SD card is written by the timer when the state stays RESUMESAVEMS.
+void resumeCheckpoint( void )
+{
+  resumeState_t state;
+
+  if ( resumeMode == 0 || systemParam.remoconMode || replayer.isReplaying() ) return;
+  if ( systemParam.phase == PHASE_WAIT_USB_CONNECT ) return;  // The checkpoint before the reset is kept.
+  resumeCapture( &state );
+  if ( memcmp( &state, &resumeLast, sizeof( state ) ) == 0 ) return;
+  resumeLast = state;
+  resumeStore.save( &state, sizeof( state ) );
+  scheduler.stop( resumeTimer );
+  resumeTimer = scheduler.once( "resume", RESUMESAVEMS, resumeFlushTask, NULL );
+}
+
+// Write the checkpoint to the SD card.
+void resumeFlushTask( void *arg )
+{
+  resumeTimer = TIMER_NONE;
+  memScope_t memScope = memTelemetry.enter( MEM_CONFIG );
+  if ( !resumeStore.flush( SD ) ) {
+    Serial.printf( "Checkpoint not written.\n" );
+  }
+  memTelemetry.leave( memScope );
+}
+
+// --- Timing model of the focus moves
+// Load the timing models of the lenses of the controllers, when the lens is changed.
+// The model learned of the lens before is saved by writeSystemFile() before this.
+void motionLoad( void )
+{
+  memScope_t memScope = memTelemetry.enter( MEM_CONFIG );
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    int lens = controllerLensIndex( i );
+    if ( controller[i].motion.lens() != lens ) {
+      controller[i].motion.setLens( lens, motionStore.read( SD, lensLibrary.get( lens )->lensName.c_str() ) );
+    }
+  }
+  selectlensInfo = lensLibrary.get( systemParam.lensIndex );   // The window may be read again.
+  memTelemetry.leave( memScope );
+}
+
+// Save the timing models learned, by the lens name. The model not written is kept dirty, and is tried again next time.
+void motionSave( void )
+{
+  memScope_t memScope = memTelemetry.enter( MEM_CONFIG );
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    LensMotion *motion = &controller[i].motion;
+    if ( !motion->isDirty() || motion->lens() < 0 ) continue;
+    String lensName = lensLibrary.get( motion->lens() )->lensName;
+    if ( motionStore.write( SD, lensName.c_str(), motion->toString() ) ) {
+      motion->saved();
+    } else {
+      Serial.printf( "Motion of %s not saved.\n", lensName.c_str() );
+    }
+  }
+  selectlensInfo = lensLibrary.get( systemParam.lensIndex );
+  memTelemetry.leave( memScope );
+}
+
+/*************************************************************************
+ * NAME  motionSent -
+ *
+ * SYNOPSIS
+ *
+ *    void motionSent( int index, const lensCommand_t *cmd )
+ *
+ * DESCRIPTION
+ *  The command is sent to the lens controller of the <index>. The move is
+ *  measured, and "P#" and the commands of the host are held until the move
+ *  is expected to end. The probe ("P#") is sent a little before the end,
+ *  and again every MOTION_POLLMS while the lens is moving.
+ *  Nothing is done in the replay, the time of the record is not of the lens.
+ *************************************************************************/
+void motionSent( int index, const lensCommand_t *cmd )
+{
+  lensController_t *c = &controller[index];
+  int target;
+
+  if ( !motionModel || replayer.isReplaying() ) return;
+  if ( cmd->owner == CMD_MOTION ) {
+    c->motion.probeSent( micros() );
+    return;
+  }
+  tokenView_t view = { &cmd->command[1], (int)strlen( cmd->command ) - 2 };   // "Mxxxx#"
+  if ( cmd->command[0] != 'M' || !Tokenizer::parseInt( &view, &target ) ) return;
+  bool wasMoving = c->motion.isMoving();
+  unsigned long nowUs = micros();
+  unsigned long endUs = c->motion.moved( target, nowUs );
+  if ( !c->motion.isMoving() ) return;
+  c->pipeline.hold( endUs );
+  if ( !wasMoving ) {
+    c->motionTimer = scheduler.once( "motion", c->motion.probeDelayMs( nowUs ), motionProbeTask, c );
+  }
+}
+
+// Send the probe of the move in front of the commands.
+// When the queue is full, the probe is tried again later, and the commands held go out at the end of the hold.
+void motionProbeTask( void *arg )
+{
+  lensController_t *c = (lensController_t *)arg;
+  c->motionTimer = TIMER_NONE;
+  if ( !c->motion.isMoving() || !c->connected ) return;
+  if ( !c->pipeline.pushFront( "P#", CMD_MOTION ) ) {
+    if ( c->motion.probeDropped() == MOTION_MOVING ) {
+      c->motionTimer = scheduler.once( "motion", MOTION_POLLMS, motionProbeTask, c );
+    } else {
+      c->pipeline.release();
+    }
+    return;
+  }
+  pumpLensController( c - controller );
+}
+
+// The reply of the probe. The commands held are sent when the move ends.
+void motionReply( int index, const char *frame )
+{
+  lensController_t *c = &controller[index];
+  int position;
+
+  if ( !Tokenizer::parseInt( frame, &position ) ) {
+    c->stat.malformed++;
+    c->motion.stop();
+    c->pipeline.release();
+    return;
+  }
+  unsigned long learned = c->motion.stat.learned;
+  if ( c->motion.reply( position ) == MOTION_MOVING ) {
+    c->pipeline.hold( micros() + MOTION_POLLMS * 1000UL );
+    c->motionTimer = scheduler.once( "motion", MOTION_POLLMS, motionProbeTask, c );
+    return;
+  }
+  c->pipeline.release();
+  if ( c->motion.stat.learned != learned ) {
+    const motionStat_t *stat = &c->motion.stat;
+    Serial.printf( "Motion %d lens %d samples %d offset %dms speed %d/s error avg %lums max %lums\n", index, c->motion.lens(),
+                   c->motion.samples(), c->motion.offset(), c->motion.speed(),
+                   stat->predicted ? stat->errorMsTotal / stat->predicted : 0, stat->errorMsMax );
+    scheduler.stop( motionSaveTimer );
+    motionSaveTimer = scheduler.once( "motionSave", MOTIONSAVEMS, motionSaveTask, NULL );
+  }
+}
+
+// Save the timing models learned.
+void motionSaveTask( void *arg )
+{
+  motionSaveTimer = TIMER_NONE;
+  motionSave();
+}
+
+// Setup
+/*************************************************************************
+ * NAME  setup - 
+ * SYNOPSIS
+ *
+ *    void setup( void )
+ *
+ * DESCRIPTION
+ *  
+ *************************************************************************/
+void setup()
+{
+  // initialize the M5Stack object
+  M5.begin( true, true, true, true );
+  M5.Power.begin();
+  Wire.begin();
+
+#ifdef BENCHMARK
+  runBenchmarks();
+#endif
+
+  bootTrace.mark( "m5 begin" );
+  useEncoder = false;   // The faces encoder is probed by the timer after the boot.
+  latestEncoderPosition = 0;
+  latestButtonStatus = false;
+  indicatorAfterPattern = false;
+  btReadyMarked = false;
+  btBeginStackFree = 0;
+  recvLineSerialIndex = 0;
+  memSampleMs = MEM_SAMPLEMS;
+  resumeMode = 0;
+  resumePhase = PHASE_WAIT_USB_CONNECT;
+  resumeTimer = TIMER_NONE;
+  motionModel = false;
+  motionSaveTimer = TIMER_NONE;
+  remoteSeq = 0;
+  remoteSequenced = false;
+  requestSeq = 0;
+  focusSeq = 0;
+  apertureSeq = 0;
+  focusSendTimer = TIMER_NONE;
+  focusSentTime = 0;
+  lastBatteryLevel = 0;
+  recvLineBTIndex = 0;
+  connectBT = 0;
+  remoteKeyMask = 0;
+  remoteKeyTime = 0;
+  latestKeyMask = 0;
+  latestKeyTime = 0;
+  perserBudgetUs = PERSERBUDGETUS;
+  bridgeMode = false;
+  bridgeActive = false;
+  bridgeIndexed = false;
+  bridgeReportCommands = 0;
+  recordedKeyMask = 0;
+  recordedEncoderPosition = 0;
+  recordedController = 0;
+  replayController = 0;
+  replayBTRead = false;
+  replayBTOut = "";
+  replayKeyMask = 0;
+  replayEncoderPosition = 0;
+  memset( &perserStatBT, 0, sizeof( perserStatBT ) );
+  refusedBT = 0;
+
+  Serial.printf( "Start\n" );
+
 
   // Display base images
   M5.Lcd.fillScreen( TFT_BLACK );
@@ -636,27 +1621,36 @@ void setup()
   labelBtnB->caption( TFT_WHITE, "DOWN" );
   labelBtnC->caption( TFT_WHITE, "UP" );
 
-  delay( 300 );
+  bootTrace.mark( "display" );
 
-  readLensInfoFile();
+  memScope_t memScope = memTelemetry.enter( MEM_CONFIG );
   readSystemFile();
+  memTelemetry.leave( memScope );
+  controllerBegin();
+  bootTrace.mark( "config" );
+
+  // The tasks of the Bluetooth stack are looked up by the name when they are started.
+  memTelemetry.addTask( "loopTask", xTaskGetCurrentTaskHandle() );
+  memTelemetry.addTask( "BTC_TASK", NULL );
+  memTelemetry.addTask( "BTU_TASK", NULL );
+  memTelemetry.addTask( "btController", NULL );
+
+  // The Bluetooth stack starts on the other core, while the USB and the lens list are made ready.
+  btReady = false;
+  xTaskCreatePinnedToCore( btBeginTask, "btBegin", BTBEGINSTACK, NULL, 1, NULL, 0 );
 
-  labelLensNameTitle->caption( TFT_GREEN, "Lens" );
-  lensSelect();
-  
   uint8_t macBT[6];
   char macBTbuff[32];
   esp_read_mac( macBT, ESP_MAC_BT );
   sprintf( macBTbuff, "%02X:%02X:%02X:%02X:%02X:%02X", macBT[0], macBT[1], macBT[2], macBT[3], macBT[4], macBT[5] );
   myMacBTString = String( macBTbuff );
   if ( systemParam.remoconMode ) {
-    SerialBT.begin( "M5StackCLC", true ); // I am Host. Bluetooth device name
     labelStatus->caption( TFT_WHITE, "Attempting connect to controller %s", systemParam.macBTString.c_str() );
     systemParam.phase = PHASE_WAIT_BT_CONNECT;
   } else {
     labelMacBT->caption( TFT_WHITE, "macBT %s", myMacBTString.c_str() );
-    SerialBT.begin( "M5StackCLC" ); // I am Devuce. Bluetooth device name
     String USB_STATUS;
+    // The enumeration of the lens controllers goes on in Usb.Task() of the loop.
     if ( Usb.Init() == -1 ) {
       Serial.println( "OSC did not start." );
       USB_STATUS = "OSC did not start.";
@@ -666,9 +1660,41 @@ void setup()
     }
     labelStatus->caption( TFT_YELLOW, USB_STATUS );
     systemParam.phase = PHASE_WAIT_USB_CONNECT;
+    bootTrace.mark( "usb host" );
   }
-  delay( 300 );
 
+  readLensInfoFile();
+  bootTrace.mark( "lens list" );
+
+  if ( glyphCacheBytes > 0 && glyphCache.begin( NUMERALFONT, glyphCacheBytes ) ) {
+    Serial.printf( "Glyph cache %u bytes\n", glyphCache.size() );
+    labelAperture->setGlyphCache( &glyphCache );
+    labelFocus->setGlyphCache( &glyphCache );
+  }
+
+  resumeBegin();
+  motionStore.begin( MOTIONFILENAME );
+  motionLoad();
+  labelLensNameTitle->caption( TFT_GREEN, "Lens" );
+  lensSelect();
+  bootTrace.mark( "lens" );
+
+  if ( replaySessionFile != "" ) {
+    if ( replayer.begin( SD, replaySessionFile.c_str() ) ) {
+      Serial.printf( "Replay : %s\n", replaySessionFile.c_str() );
+      memset( &replayStat, 0, sizeof( replayStat ) );
+      replayStat.startTime = millis();
+    }
+  } else if ( recordSession ) {
+    if ( recorder.begin( SD, SESSIONFILENAME ) ) {
+      Serial.printf( "Record : %s\n", SESSIONFILENAME );
+    }
+  }
+  startTimers();
+  int32_t state[5] = { systemParam.phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition, systemParam.remoconMode };
+  recorder.record( REC_STATE, state, sizeof( state ) );
+  recordedPhase = systemParam.phase;
+  bootTrace.mark( "setup" );
 }
 
 // Main Loop
@@ -684,150 +1710,92 @@ void setup()
  *************************************************************************/
 void loop( void )
 {
+  unsigned long loopStart = micros();
+  memScope_t memScope;
+
+  memScope = memTelemetry.enter( MEM_USB );
   Usb.Task();
+  memTelemetry.leave( memScope );
   M5.update();
+  memScope = memTelemetry.enter( MEM_TIMER );
+  scheduler.update( millis() );   // The timers due.
+  memTelemetry.leave( memScope );
+  if ( btReady && !btReadyMarked ) {
+    bootTrace.mark( "bluetooth", btReadyUs );
+    memTelemetry.taskFinished( "btBegin", btBeginStackFree );
+    btReadyMarked = true;
+  }
+  receiveSerial();
 
-  switch ( systemParam.phase ) {
-  case PHASE_WAIT_USB_CONNECT:  // // Waiting for the lens controller to be connected.
-    if ( FtdiAsync.flagOnInit ) {
-      String USB_STATUS;
-      USB_STATUS = "USB FTDI CDC Baud Rate:" + String( baud ) + "bps";
-      labelStatus->caption( TFT_YELLOW, USB_STATUS );
-      Ftdi.SndData( 2, (uint8_t*)"P#" );
-      systemParam.phase = PHASE_LENS;
-    }
-    break;
+  if ( replayer.isReplaying() ) {
+    replaySession();
+  }
 
+  if ( !systemParam.remoconMode ) {
+    memScope = memTelemetry.enter( MEM_USB );
+    controllerTask();   // Waiting for the lens controllers to be connected.
+    memTelemetry.leave( memScope );
+  }
+
+  switch ( systemParam.phase ) {
   case PHASE_WAIT_BT_CONNECT:  // // Waiting for the Bluetooth serial to be connected.
-    connectBT = SerialBT.connect( systemParam.macBT );
-    Serial.printf( "connectBT=%d\n", connectBT );
+    if ( !replayer.isReplaying() ) {
+      if ( !btReady ) break;
+      connectBT = SerialBT.connect( systemParam.macBT );
+      Serial.printf( "connectBT=%d\n", connectBT );
+    }
     if ( connectBT ) {
+      recorder.record( REC_CONNECT, "B" );
       labelStatus->caption( TFT_YELLOW, "Connected to controller %s", systemParam.macBTString.c_str() );
       if ( useEncoder ) {
         encoder.ringLight( (uint16_t *)connectRingLitPattern, 20, ledColorConnect );
       }
       incremet = 1;
       currentLightIndicator = 0;
-      lightIndicator();
-      SerialBT.printf( "Q%s#", myMacBTString.c_str() );
+      indicatorAfterPattern = true;   // lightIndicator() after the pattern
+      sendBT( "Q%s#", myMacBTString.c_str() );
       systemParam.phase = PHASE_LENS;
     }
     break;
   }
 
+  memScope = memTelemetry.enter( MEM_UI );
   if ( !systemParam.remoconMode ) {
-    switch ( systemParam.phase ) {
-    case PHASE_LENS:    // Lens selection in progress.
-      if ( M5.BtnA.wasPressed() || ( virtualKeyMap[0] == 'A' ) ) {
-        systemParam.phase = PHASE_APERTURE;
-        selectLensDisplay();
-        lensSelect();
-        apertureSelect( 0 );
-        focusPosition();
-        writeSystemFile();
-        SerialBT.printf( "P%d %d %d %d#", systemParam.phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
-      }
-      if ( M5.BtnC.wasPressed() || ( virtualKeyMap[0] == 'C' ) ) {
-        lensSelectNext();
-        if ( connectBT ) {
-          SerialBT.printf( "L%d %d#", systemParam.phase, systemParam.lensIndex );
-        }
-      }
-      if ( M5.BtnB.wasPressed() || ( virtualKeyMap[0] == 'B' ) ) {
-        lensSelectPrev();
-        if ( connectBT ) {
-          SerialBT.printf( "L%d %d#", systemParam.phase, systemParam.lensIndex );
-        }
-      }
-      break;
-    case PHASE_APERTURE:  // Aperture selection in progress.
-      if ( M5.BtnA.wasPressed() || ( virtualKeyMap[0] == 'A' ) ) {
-        systemParam.phase = PHASE_FOCUS;
-        labelApertureTitle->caption( TFT_WHITE, "Aperture" );
-        labelFocusTitle->caption( TFT_GREEN, "Focus" );
-        apertureSelect();
-        focusPosition();
-        if ( connectBT ) {
-          SerialBT.printf( "F%d %d#", systemParam.phase, systemParam.focusPosition );
-        }
-      }
-      if ( M5.BtnC.wasPressed() || ( virtualKeyMap[0] == 'C' ) ) {
-        apertureSelectNext();
-        if ( connectBT ) {
-          SerialBT.printf( "A%d %d#", systemParam.phase, systemParam.apertureIndex );
-        }
-      }
-      if ( M5.BtnB.wasPressed() || ( virtualKeyMap[0] == 'B' ) ) {
-        apertureSelectPrev();
-        if ( connectBT ) {
-          SerialBT.printf( "A%d %d#", systemParam.phase, systemParam.apertureIndex );
-        }
-      }
-      break;
-    case PHASE_FOCUS:   // Adjusting the focus position of the lens.
-      if ( M5.BtnA.wasPressed() || ( virtualKeyMap[0] == 'A' ) ) {
-        if ( M5.BtnC.isPressed() || ( virtualKeyMap[1] == 'C' ) ) { 
-          focusPositionIncrease( +10 );
-          if ( connectBT ) {
-          SerialBT.printf( "F%d %d#", systemParam.phase, systemParam.focusPosition );
-          }
-        } else if ( M5.BtnB.isPressed() || ( virtualKeyMap[1] == 'B' ) ) {
-          focusPositionIncrease( -10 );
-          if ( connectBT ) {
-          SerialBT.printf( "F%d %d#", systemParam.phase, systemParam.focusPosition );
-          }
-        } else {
-          systemParam.phase = PHASE_APERTURE;
-          labelFocusTitle->caption( TFT_WHITE, "focus" );
-          labelApertureTitle->caption( TFT_GREEN, "Aperture" );
-          focusPosition();
-          apertureSelect();
-          if ( connectBT ) {
-          SerialBT.printf( "A%d %d#", systemParam.phase, systemParam.apertureIndex );
-          }
-        }
-      }
-      if ( M5.BtnC.wasPressed() || ( virtualKeyMap[0] == 'C' ) ) {
-        focusPositionIncrease( +1 );
-        if ( connectBT ) {
-          SerialBT.printf( "F%d %d#", systemParam.phase, systemParam.focusPosition );
-        }
-      }
-      if ( M5.BtnB.wasPressed() || ( virtualKeyMap[0] == 'B' ) ) {
-        focusPositionIncrease( -1 );
-        if ( connectBT ) {
-          SerialBT.printf( "F%d %d#", systemParam.phase, systemParam.focusPosition );
-        }
+    // The buttons of the remote and of myself go through the same key engine.
+    if ( remoteKeyMask && ( millis() - remoteKeyTime ) > REMOTEKEYTIMEOUTMS ) {
+      remoteKeyMask = 0;    // Lost the remote while the button is held down.
+    }
+    if ( replayer.isReplaying() ) {
+      keyEngine.clear();    // The recorded key events are dispatched by the replay.
+    } else {
+      keyEngine.update( readKeyMask() | remoteKeyMask, millis() );
+      keyEvent_t keyEvent;
+      while ( keyEngine.pop( &keyEvent ) ) {
+        recorder.record( REC_KEY, &keyEvent, sizeof( keyEvent ) );
+        keyEngine.dispatch( systemParam.phase, keyBindings, NUMBER_OF_KEYBINDINGS, &keyEvent );
       }
-      break;
     }
-    virtualKeyMap[0] = virtualKeyMap[1] = virtualKeyMap[2] = 0;
   }
     
   if ( systemParam.remoconMode && connectBT ) {
-    if ( M5.BtnA.wasPressed() ) {
-      if ( M5.BtnC.isPressed() ) { 
-        SerialBT.printf( "BAC#" );
-      } else if ( M5.BtnB.isPressed() ) {
-        SerialBT.printf( "BAB#" );
-      } else {
-        SerialBT.printf( "BA #" );
-      }
-    } else if ( M5.BtnC.wasPressed() ) {
-        SerialBT.printf( "BC #" );
-    } else if ( M5.BtnB.wasPressed() ) {
-        SerialBT.printf( "BB #" );
+    // Send the buttons held down, and resend them while held down.
+    uint8_t keyMask = readKeyMask();
+    if ( keyMask != latestKeyMask || ( keyMask && ( millis() - latestKeyTime ) >= REMOTEKEYREFRESHMS ) ) {
+      sendBT( "K%d %u#", keyMask, ++requestSeq );
+      remotePredictKey( keyMask & ~latestKeyMask, keyMask );
+      latestKeyMask = keyMask;
+      latestKeyTime = millis();
     }
-    if ( useEncoder ) {
+    if ( useEncoder || replayer.isReplaying() ) {
      // Rotate the encoder clockwise and the focus will be farther away.
      // Rotate the encoder counter-clockwise brings the focus closer.
       switch ( systemParam.phase ) {
       case PHASE_APERTURE:  // Aperture selection in progress.
       case PHASE_FOCUS:   // Adjusting the focus position of the lens.
-        int16_t position = encoder.getCurrentPosition();
+        int16_t position = readEncoderPosition();
         int16_t diff = position - latestEncoderPosition;
         if ( diff != 0 ) {
-          SerialBT.printf( "f%d#", position );
+          remotePredictFocus( position );
           latestEncoderPosition = position;
           encoder.ringLight( currentLightIndicator, 0, 0, 0 );
           diff /= incremet;
@@ -853,33 +1821,238 @@ void loop( void )
       }
     }
   }
-
-  // Battery indicator of one second interval.
-  // refererd by ProgramResource.net. Thanks ねふぁさん
-  if ( !systemParam.remoconMode ) {
-    if ( batteryUpdateTime < millis() ) {
-      batteryUpdateTime = millis() + BATTERYUPDATETIMEMS;
-      if ( M5.Power.canControl() ) {
-        int batteryLevel = M5.Power.getBatteryLevel();
-        if ( lastBatteryLevel != batteryLevel ) {
-          // Rewrite only when the battery state changes.
-          indicateBatteryLevel( batteryLevel );
-          lastBatteryLevel = batteryLevel;
-          if ( connectBT ) {
-            SerialBT.printf( "V%d#", batteryLevel );
-          }
-        }
-      }
-    }
-  }
+  memTelemetry.leave( memScope );
 
   // USB data processing
   if ( !systemParam.remoconMode ) {
+    memScope = memTelemetry.enter( MEM_USB );
     perserUSB();
+    memTelemetry.leave( memScope );
   }
 
   // Bluetooth serial data processing
+  memScope = memTelemetry.enter( MEM_BT );
   perserBT();
+  memTelemetry.leave( memScope );
+
+  resumeCheckpoint();
+
+  memScope = memTelemetry.enter( MEM_RECORDER );
+  if ( systemParam.phase != recordedPhase ) {
+    uint8_t phase = systemParam.phase;
+    recorder.record( REC_PHASE, &phase, 1 );
+    recordedPhase = systemParam.phase;
+  }
+  recorder.flush( false );
+  memTelemetry.leave( memScope );
+
+  if ( replayer.isReplaying() ) {
+    unsigned long loopUs = micros() - loopStart;
+    replayStat.loops++;
+    replayStat.loopTotalUs += loopUs;
+    if ( loopUs > replayStat.loopMaxUs ) replayStat.loopMaxUs = loopUs;
+  }
+}
+
+/*************************************************************************
+ * NAME  replaySession - 
+ *
+ * SYNOPSIS
+ *
+ *    void replaySession( void )
+ *
+ * DESCRIPTION
+ *  Feed one record of the recorded session in each loop.
+ *  The frames received in one loop of the session are fed in one loop.
+ *  The frames of the Bluetooth serial are read by receiveBT() up to REC_BT_END,
+ *  so the perser reads and coalesces them as in the session.
+ *  The inputs go through the same parsers and the state machine,
+ *  and the outputs are compared with the recorded outputs.
+ *************************************************************************/
+void replaySession( void )
+{
+  sessionRecord_t rec;
+
+  if ( replayBTRead ) return;
+  if ( replayer.peek( &rec ) && rec.type == REC_BT_IN ) {
+    replayBTRead = true;
+    return;
+  }
+  if ( !replayer.next( &rec ) ) {
+    replayReport();
+    replayer.end();
+    return;
+  }
+  replayStat.records++;
+  replayStat.sessionTime = rec.time;
+  replayRecord( &rec );
+}
+
+// Feed one record except the frames of the Bluetooth serial.
+void replayRecord( sessionRecord_t *rec )
+{
+  keyEvent_t keyEvent;
+  int32_t state[5];
+  char label[REC_MAXDATA + 4];
+
+  switch ( rec->type ) {
+  case REC_STATE:
+    memcpy( state, rec->data, sizeof( state ) );
+    systemParam.phase = state[0];
+    systemParam.lensIndex = state[1];
+    systemParam.apertureIndex = state[2];
+    systemParam.focusPosition = state[3];
+    systemParam.remoconMode = state[4];
+    replayController = 0;
+    break;
+  case REC_CONTROLLER:
+    replayController = ( rec->data[0] < numberOfControllers ) ? rec->data[0] : 0;
+    break;
+  case REC_USB_IN:
+    // The frames received at the same time are given together, as they were coalesced in the session.
+    for ( ;; ) {
+      lensController_t *c = &controller[replayController];
+      c->stat.received++;
+      if ( c->queue->isFull() ) {
+        c->stat.dropped++;
+      } else {
+        c->queue->push( String( (char *)rec->data ) );
+      }
+      sessionRecord_t nextRec;
+      if ( !replayer.peek( &nextRec ) || nextRec.type != rec->type || nextRec.time != rec->time ) break;
+      replayer.next( rec );
+      replayStat.records++;
+    }
+    break;
+  case REC_USB_OUT:
+    controllerLabel( replayController, (char *)rec->data, label );
+    replayExpect( 'U', label );
+    break;
+  case REC_BT_OUT:
+    replayBTOut += (char *)rec->data;
+    if ( rec->length < REC_MAXDATA ) {
+      replayExpect( 'B', replayBTOut.c_str() );
+      replayBTOut = "";
+    }
+    break;
+  case REC_KEY:
+    memcpy( &keyEvent, rec->data, sizeof( keyEvent ) );
+    keyEngine.dispatch( systemParam.phase, keyBindings, NUMBER_OF_KEYBINDINGS, &keyEvent );
+    break;
+  case REC_KEYMASK:
+    replayKeyMask = rec->data[0];
+    break;
+  case REC_ENCODER:
+    memcpy( &replayEncoderPosition, rec->data, sizeof( replayEncoderPosition ) );
+    break;
+  case REC_PHASE:
+    if ( rec->data[0] != systemParam.phase ) {
+      replayStat.phaseDiverged++;
+      Serial.printf( "Replay %lums: phase %d, recorded %d\n", rec->time, systemParam.phase, rec->data[0] );
+    }
+    break;
+  case REC_CONNECT:
+    if ( rec->data[0] == 'U' ) {
+      controllerConnect( replayController );
+    } else {
+      connectBT = 1;
+    }
+    break;
+  }
+}
+
+// Returns true if the record is made while the perser reads the Bluetooth serial.
+bool replayInPerserBT( uint8_t type )
+{
+  return type == REC_BT_IN || type == REC_BT_OUT || type == REC_USB_OUT || type == REC_CONTROLLER
+         || type == REC_KEYMASK || type == REC_BT_END;
+}
+
+// The battery level is not the same in the replay, it is not compared.
+bool replayCompared( const char *buff )
+{
+  return buff[0] != 'V';
+}
+
+// Output of the record to be compared.
+void replayExpect( char kind, const char *buff )
+{
+  if ( !replayCompared( buff ) ) return;
+  if ( replayExpected.isFull() ) {
+    replayStat.missing++;
+    return;
+  }
+  replayExpected.push( String( kind ) + buff );
+  replayMatch();
+}
+
+// Output of the replay to be compared.
+void replayOutput( char kind, const char *buff )
+{
+  if ( !replayCompared( buff ) ) return;
+  if ( replayProduced.isFull() ) {
+    replayStat.extra++;
+    return;
+  }
+  replayProduced.push( String( kind ) + buff );
+  replayMatch();
+}
+
+// Compare the outputs in order.
+void replayMatch( void )
+{
+  while ( replayExpected.count() > 0 && replayProduced.count() > 0 ) {
+    String expected = replayExpected.pop();
+    String produced = replayProduced.pop();
+    if ( expected == produced ) {
+      replayStat.matched++;
+    } else {
+      replayStat.diverged++;
+      Serial.printf( "Replay %lums: expected %s, produced %s\n", replayStat.sessionTime, expected.c_str(), produced.c_str() );
+    }
+  }
+}
+
+// Report the result of the replay.
+void replayReport( void )
+{
+  replayStat.missing += replayExpected.count();
+  replayStat.extra += replayProduced.count();
+  replayExpected.clear();
+  replayProduced.clear();
+  unsigned long replayTime = millis() - replayStat.startTime;
+  Serial.printf( "Replay finished : %lu records, session %lu ms, replayed in %lu ms\n", replayStat.records, replayStat.sessionTime, replayTime );
+  Serial.printf( "  outputs matched %lu, diverged %lu, missing %lu, extra %lu, phase diverged %lu\n",
+                 replayStat.matched, replayStat.diverged, replayStat.missing, replayStat.extra, replayStat.phaseDiverged );
+  if ( replayStat.loops > 0 ) {
+    Serial.printf( "  loop %lu us average, %lu us max\n", replayStat.loopTotalUs / replayStat.loops, replayStat.loopMaxUs );
+  }
+  // Every frame of the Bluetooth serial is processed or coalesced to a newer one.
+  long lostBT = (long)( perserStatBT.received - perserStatBT.processed - perserStatBT.coalesced );
+  Serial.printf( "  BT frames received %lu, processed %lu, coalesced %lu, lost %ld\n",
+                 perserStatBT.received, perserStatBT.processed, perserStatBT.coalesced, lostBT );
+  perserReport();
+  labelStatus->caption( ( replayStat.diverged || replayStat.missing || replayStat.extra || replayStat.phaseDiverged || lostBT ) ? TFT_RED : TFT_GREEN,
+                        "Replay %lu matched, %lu diverged", replayStat.matched, replayStat.diverged + replayStat.missing + replayStat.extra );
+}
+
+// Print the message processing statistics of the Bluetooth serial and of each lens controller.
+void perserReport( void )
+{
+  char name[8];
+
+  perserStatPrint( "BT", &perserStatBT );
+  Serial.printf( "BT refused=%lu\n", refusedBT );
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    sprintf( name, "USB %d", i );
+    perserStatPrint( name, &controller[i].stat );
+  }
+}
+
+void perserStatPrint( const char *name, const perserStat_t *stat )
+{
+  Serial.printf( "%s received=%lu processed=%lu coalesced=%lu dropped=%lu deferred=%lu malformed=%lu stale=%lu\n", name,
+                 stat->received, stat->processed, stat->coalesced, stat->dropped, stat->deferred, stat->malformed, stat->stale );
 }
 
 /*************************************************************************
@@ -890,50 +2063,162 @@ void loop( void )
  *    void perserUSB( void )
  *
  * DESCRIPTION
- *  
+ *  Receive the replies of the lens controllers, and process the queued replies
+ *  of each controller within the time budget. Every controller processes at least
+ *  one reply in a loop, so a busy controller does not delay the others.
  *************************************************************************/
 void perserUSB( void )
 {
-  if ( queueUSB.count() > 0 ) {  // Check for serial command
-    String replystr;
-    replystr = queueUSB.pop();   // Take out receive data
-    Serial.println( replystr );
-    systemParam.focusPosition = replystr.toInt(); // Set current focus position
-    setApertureValue( 0 );  // Set the aperture wide open.
-  }
-
-  // USB data receive
-  if ( Usb.getUsbTaskState() == USB_STATE_RUNNING ) {
-    uint8_t rcode;
-    uint8_t buff[64];
+  unsigned long startTime = micros();
 
-    memset( buff, 0, 64 );
-    uint16_t rcvd = 64;
-    rcode = Ftdi.RcvData( &rcvd, buff );
+  receiveUSB();
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    perserController( i, startTime );
+  }
+}
 
-    if ( rcode && rcode != hrNAK ) {
-      ErrorMessage<uint8_t>( PSTR("Ret"), rcode );
+// Process the replies of one lens controller.
+// The reply to the "P#" of the host is sent back to the host.
+// Of the replies to the local, only the latest focus position is used.
+void perserController( int index, unsigned long startTime )
+{
+  lensController_t *c = &controller[index];
+  String replystr;
+  int nFrame = 0;
+  int nReply = 0;
+  while ( c->queue->count() > 0 ) {  // Check for serial command
+    if ( nFrame > 0 && ( micros() - startTime ) >= perserBudgetUs ) {
+      c->stat.deferred++;
+      break;
+    }
+    String frame = c->queue->pop();   // Take out receive data
+    Serial.println( frame );
+    nFrame++;
+    int owner = c->pipeline.reply( micros() );
+    if ( owner == CMD_HOST ) {
+      bridgeReply( index, frame );
+      continue;
+    }
+    if ( owner == CMD_MOTION ) {
+      motionReply( index, frame.c_str() );
+      continue;
     }
-    // The device reserves the first two bytes of data
-    //   to contain the current values of the modem and line status registers.
-    if ( rcvd > 2 ) {
-      for ( int i = 2; i < rcvd; i++ ) {
-        char inChar = buff[i];
-        if ( inChar == '#' ) {
-          recvLineUSBIndex = 0;
-          queueUSB.push( String( recvLineUSB ) );
-          memset( recvLineUSB, 0, RECVLINES );
+    replystr = frame;
+    nReply++;
+  }
+  if ( nReply > 0 ) {
+    c->stat.processed++;
+    c->stat.coalesced += nReply - 1;
+    if ( !Tokenizer::parseInt( replystr.c_str(), controllerFocus( index ) ) ) { // Set current focus position
+      c->stat.malformed++;
+    } else {
+      c->motion.position( *controllerFocus( index ) );
+      if ( !c->initialised ) {
+        // The first read-back after the connection. Set the aperture wide open, or the aperture of the checkpoint after the resume.
+        // A later reply (unsolicited) only updates the focus, the aperture chosen is kept.
+        bootFinish( "focus ready" );
+        char buff[16];
+        sprintf( buff, "A%02d#", ( c->resumeAperture >= 0 ) ? c->resumeAperture : 0 );
+        c->resumeAperture = -1;
+        c->initialised = true;
+        controllerSend( index, buff, CMD_LOCAL );
+      }
+    }
+  }
+  pumpLensController( index );   // The commands held for the reply.
+}
+
+// USB data receive of all of the lens controllers
+void receiveUSB( void )
+{
+  if ( replayer.isReplaying() ) return;   // The replay gives the frames.
+  for ( int n = 0; n < numberOfControllers; n++ ) {
+    lensController_t *c = &controller[n];
+    uint8_t buff[64];
+    int rcvd = c->port->receive( buff, sizeof( buff ) );
+    for ( int i = 0; i < rcvd; i++ ) {
+      if ( frameCharacter( buff[i], c->recvLine, &c->recvLineIndex ) ) {
+        c->stat.received++;
+        if ( c->pipeline.awaitedOwner() != CMD_MOTION ) {   // The reply of the probe is not recorded.
+          recordController( n );
+          recorder.record( REC_USB_IN, c->recvLine );
+        }
+        if ( c->queue->isFull() ) {
+          c->stat.dropped++;
         } else {
-          recvLineUSB[recvLineUSBIndex++] = inChar;
-          if ( recvLineUSBIndex >= RECVLINES ) {
-            recvLineUSBIndex = RECVLINES - 1;
-          }
+          c->queue->push( String( c->recvLine ) );
         }
+        memset( c->recvLine, 0, RECVLINES );
       }
     }
   }
 }
 
+// --- Prediction of the remote
+// Draw the focus of the encoder at once. The position is sent every REMOTEFOCUSMS,
+// at once if the last one is older, or by the timer with the latest position.
+void remotePredictFocus( int position )
+{
+  predictedFocus = position;
+  focusSeq = ++requestSeq;
+  systemParam.focusPosition = position;
+  focusPosition();
+  if ( focusSendTimer != TIMER_NONE ) {
+    perserStatBT.coalesced++;   // The timer sends the latest one.
+    return;
+  }
+  unsigned long elapsed = millis() - focusSentTime;
+  if ( elapsed >= REMOTEFOCUSMS ) {
+    remoteSendFocus( NULL );
+  } else {
+    focusSendTimer = scheduler.once( "focusSend", REMOTEFOCUSMS - elapsed, remoteSendFocus, NULL );
+  }
+}
+
+// Send the latest position of the encoder with the sequence number of it.
+void remoteSendFocus( void *arg )
+{
+  focusSendTimer = TIMER_NONE;
+  focusSentTime = millis();
+  sendBT( "f%d %u#", predictedFocus, focusSeq );
+}
+
+// Draw the result of the button pressed alone on the remote, as the key bindings of the controller.
+// The request is the "K" just sent.
+void remotePredictKey( uint8_t pressed, uint8_t keyMask )
+{
+  if ( pressed == 0 || pressed != keyMask ) return;
+  int direction = ( pressed == KEYBIT_C ) ? 1 : ( pressed == KEYBIT_B ) ? -1 : 0;
+  if ( direction == 0 ) return;
+  switch ( systemParam.phase ) {
+  case PHASE_APERTURE:
+    systemParam.apertureIndex += direction;
+    if ( systemParam.apertureIndex >= selectlensInfo->numberOfAperture ) {
+      systemParam.apertureIndex = 0;
+    } else if ( systemParam.apertureIndex < 0 ) {
+      systemParam.apertureIndex = selectlensInfo->numberOfAperture - 1;
+    }
+    apertureSeq = requestSeq;
+    apertureSelect();
+    break;
+  case PHASE_FOCUS:
+    systemParam.focusPosition += direction;
+    focusSeq = requestSeq;
+    focusPosition();
+    break;
+  }
+}
+
+// Returns true if the state of the request <seq> is older than the prediction of the request <predicted>.
+// The state without the sequence number (the previous version of the controller) is always used.
+bool remoteIsStale( bool hasSeq, int seq, uint16_t predicted )
+{
+  if ( !hasSeq ) return false;
+  if ( (int16_t)( (uint16_t)seq - predicted ) >= 0 ) return false;
+  perserStatBT.stale++;
+  return true;
+}
+
 /*************************************************************************
  * NAME  perserBT - 
  *
@@ -942,111 +2227,480 @@ void perserUSB( void )
  *    void perserBT( void )
  *
  * DESCRIPTION
- *  
+ *  Receive the Bluetooth serial, and process all of the queued messages
+ *  within the time budget. A run of "f" messages is coalesced to the latest position.
+ *  Any other message flushes the pending "f" first, so the order is kept.
  *************************************************************************/
 void perserBT( void )
 {
-  String paramStringList[8];
+  unsigned long startTime = micros();
+  String pendingFocus;
+  bool hasPendingFocus = false;
+  int nProcessed = 0;
+  unsigned long received = perserStatBT.received;
+
+  do {
+    receiveBT();
+    while ( queueBT.count() > 0 ) {  // Check for serial command
+      if ( nProcessed > 0 && ( micros() - startTime ) >= perserBudgetUs ) {
+        perserStatBT.deferred++;
+        break;
+      }
+      String replystr;
+      replystr = queueBT.pop();   // Take out receive data
+      nProcessed++;
+      if ( replystr.charAt( 0 ) == 'f' ) {
+        if ( hasPendingFocus ) {
+          perserStatBT.coalesced++;
+        }
+        pendingFocus = replystr;
+        hasPendingFocus = true;
+        continue;
+      }
+      if ( hasPendingFocus ) {
+        processBT( pendingFocus );
+        hasPendingFocus = false;
+      }
+      processBT( replystr );
+    }
+  } while ( availableBT() && !queueBT.isFull() && ( micros() - startTime ) < perserBudgetUs );
+
+  if ( hasPendingFocus ) {
+    processBT( pendingFocus );
+  }
+  if ( perserStatBT.received != received ) {
+    recorder.record( REC_BT_END, "" );  // The replay reads the frames up to here in one perser.
+  }
+}
+
+// Process one message of the Bluetooth serial.
+// The parameters are parsed in place. A message with a malformed number is ignored.
+// The fields after the known ones are ignored, for the newer version of the remote.
+void processBT( String replystr )
+{
+  int value[4];
   int nParam;
-  if ( queueBT.count() > 0 ) {  // Check for serial command
-    String replystr;
-    replystr = queueBT.pop();   // Take out receive data
-    Serial.println( replystr );
-    int cmd = replystr.charAt( 0 );
-    String param = replystr.substring( 1 );
-    switch ( cmd ) {
-    case 'Q':
-      labelStatus->caption( TFT_YELLOW, "Connected from controller %s", param.c_str() );
-      connectBT = 1;
-      SerialBT.printf( "P%d %d %d %d#", systemParam.phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
-      SerialBT.printf( "V%d#", M5.Power.getBatteryLevel() );
+  int seq;
+  bool hasSeq;
+
+  perserStatBT.processed++;
+  Serial.println( replystr );
+  if ( replystr.length() == 0 ) return;
+  int cmd = replystr.charAt( 0 );
+  const char *param = replystr.c_str() + 1;
+  if ( bridgeMode && !systemParam.remoconMode ) {
+    // The command of the host to the lens controller. "n:" addresses the controller n,
+    // without it the controller on the display.
+    int index = systemParam.controllerIndex;
+    bool indexed = isdigit( cmd ) && param[0] == ':';
+    if ( indexed ) {
+      index = cmd - '0';
+      cmd = param[1];
+      param += 2;
+    }
+    if ( cmd == 'P' || cmd == 'M' || cmd == 'A' ) {
+      if ( index >= numberOfControllers ) {
+        perserStatBT.malformed++;
+        return;
+      }
+      bridgeIndexed |= indexed;
+      bridgeCommand( index, cmd, param );
+      return;
+    }
+    if ( indexed ) {
+      perserStatBT.malformed++;
+      return;
+    }
+  }
+  Tokenizer tokens( param, ' ' );
+  switch ( cmd ) {
+  case 'Q':
+    labelStatus->caption( TFT_YELLOW, "Connected from controller %s", param );
+    connectBT = 1;
+    sendRemote( "P%d %d %d %d#", systemParam.phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
+    sendBT( "V%d#", M5.Power.getBatteryLevel() );
+    if ( numberOfControllers > 1 ) {
+      sendBT( "C%d %d#", systemParam.controllerIndex, numberOfControllers );
+    }
+    break;
+  case 'C':   // Select the lens controller. (C<index># of a host, the remote receives C<index> <count>#)
+    if ( !tokens.nextInt( &value[0] ) ) {
+      perserStatBT.malformed++;
       break;
-    case 'B':
-      virtualKeyMap[0] = param.charAt( 0 );
-      virtualKeyMap[1] = param.charAt( 1 );
+    }
+    if ( !systemParam.remoconMode ) {
+      controllerSelect( value[0] );
+    } else if ( tokens.nextInt( &value[1] ) ) {
+      labelStatus->caption( TFT_YELLOW, "Controller %d of %d", value[0] + 1, value[1] );
+    } else {
+      perserStatBT.malformed++;
+    }
+    break;
+  case 'B':   // Button pressed on the remote. (previous version of the remote)
+    if ( param[0] == '\0' || param[1] == '\0' ) break;
+    keyEngine.inject( param[0] - 'A', ( param[1] == ' ' ) ? KEY_NONE : param[1] - 'A' );
+    break;
+  case 'K':   // Buttons held down on the remote.
+    if ( !tokens.nextInt( &value[0] ) ) {
+      perserStatBT.malformed++;
       break;
-    case 'V':
-      indicateBatteryLevel( param.toInt() );
+    }
+    remoteKeyMask = value[0];
+    remoteKeyTime = millis();
+    if ( tokens.nextInt( &value[1] ) ) {
+      remoteSeq = value[1];
+      remoteSequenced = true;
+    }
+    // Every change goes to the key engine, so a short click in a burst is not lost.
+    keyEngine.update( readKeyMask() | remoteKeyMask, millis() );
+    break;
+  case 'N':   // Jump to the lens by the prefix of the name. (N<prefix>#)
+    if ( !systemParam.remoconMode && systemParam.phase == PHASE_LENS ) {
+      nParam = lensLibrary.findPrefix( param, systemParam.lensIndex );
+      if ( nParam >= 0 ) {
+        lensSelect( nParam );
+        sendRemote( "L%d %d#", systemParam.phase, systemParam.lensIndex );
+      }
+    }
+    break;
+  case 'G':   // Jump to the lens of the nearest focal length. (G<focal length>#)
+    if ( !tokens.nextInt( &value[0] ) ) {
+      perserStatBT.malformed++;
       break;
-    case 'f':
-      focusPosition( param.toInt() );
-      SerialBT.printf( "F%d %d#", systemParam.phase, systemParam.focusPosition );
+    }
+    if ( !systemParam.remoconMode && systemParam.phase == PHASE_LENS ) {
+      nParam = lensLibrary.findFocalLength( value[0] );
+      if ( nParam >= 0 ) {
+        lensSelect( nParam );
+        sendRemote( "L%d %d#", systemParam.phase, systemParam.lensIndex );
+      }
+    }
+    break;
+  case 'V':
+    if ( !tokens.nextInt( &value[0] ) ) {
+      perserStatBT.malformed++;
       break;
-    case 'L':
-      nParam = argumentSeparatorString( param, paramStringList, ' ', 8 );
-      systemParam.phase = paramStringList[0].toInt(); 
-      systemParam.lensIndex = paramStringList[1].toInt(); 
+    }
+    indicateBatteryLevel( value[0] );
+    break;
+  case 'H':   // Heap and stack telemetry. (H# is the query, the reply is H<free> <largest> <minimum> <stack> <alarms> <fragmentation>#)
+    if ( param[0] == '\0' ) {
+      char buff[64];
+      memTelemetry.summary( buff, sizeof( buff ) );
+      sendBT( "%s", buff );
+    }
+    break;
+  case 'f':
+    if ( !tokens.nextInt( &value[0] ) ) {
+      perserStatBT.malformed++;
+      break;
+    }
+    if ( tokens.nextInt( &value[1] ) ) {
+      remoteSeq = value[1];
+      remoteSequenced = true;
+    }
+    focusPosition( value[0] );
+    sendRemote( "F%d %d#", systemParam.phase, systemParam.focusPosition );
+    break;
+  case 'L':
+    if ( !tokens.nextInt( &value[0] ) || !tokens.nextInt( &value[1] ) ) {
+      perserStatBT.malformed++;
+      break;
+    }
+    systemParam.phase = value[0];
+    systemParam.lensIndex = value[1];
+    lensSelect();
+    break;
+  case 'A':
+    if ( !tokens.nextInt( &value[0] ) || !tokens.nextInt( &value[1] ) ) {
+      perserStatBT.malformed++;
+      break;
+    }
+    labelApertureTitle->caption( TFT_GREEN, "Aperture" );
+    labelFocusTitle->caption( TFT_WHITE, "Focus" );
+    systemParam.phase = value[0];
+    hasSeq = tokens.nextInt( &value[2] );
+    if ( !remoteIsStale( hasSeq, value[2], apertureSeq ) ) {
+      systemParam.apertureIndex = value[1];
+    }
+    apertureSelect();
+    focusPosition();
+    break;
+  case 'F':
+    if ( !tokens.nextInt( &value[0] ) || !tokens.nextInt( &value[1] ) ) {
+      perserStatBT.malformed++;
+      break;
+    }
+    labelApertureTitle->caption( TFT_WHITE, "Aperture" );
+    labelFocusTitle->caption( TFT_GREEN, "Focus" );
+    systemParam.phase = value[0];
+    hasSeq = tokens.nextInt( &value[2] );
+    if ( !remoteIsStale( hasSeq, value[2], focusSeq ) ) {
+      systemParam.focusPosition = value[1];
+    }
+    apertureSelect();
+    focusPosition();
+    break;
+  case 'P':
+    for ( nParam = 0; nParam < 4; nParam++ ) {
+      if ( !tokens.nextInt( &value[nParam] ) ) break;
+    }
+    if ( nParam < 4 ) {
+      perserStatBT.malformed++;
+      break;
+    }
+    systemParam.phase = value[0];
+    systemParam.lensIndex = value[1];
+    bootFinish( "focus ready" );
+    // The aperture and the focus predicted are kept while the requests of them are on the way.
+    hasSeq = tokens.nextInt( &seq );
+    if ( !remoteIsStale( hasSeq, seq, apertureSeq ) ) {
+      systemParam.apertureIndex = value[2];
+    }
+    if ( !remoteIsStale( hasSeq, seq, focusSeq ) ) {
+      systemParam.focusPosition = value[3];
+      latestEncoderPosition = systemParam.focusPosition;
+    }
+    switch ( systemParam.phase ) {
+    case PHASE_LENS:    // Lens selection in progress.
       lensSelect();
       break;
-    case 'A':
+    case PHASE_APERTURE:  // Aperture selection in progress.
+      selectLensDisplay();
       labelApertureTitle->caption( TFT_GREEN, "Aperture" );
       labelFocusTitle->caption( TFT_WHITE, "Focus" );
-      nParam = argumentSeparatorString( param, paramStringList, ' ', 8 );
-      systemParam.phase = paramStringList[0].toInt(); 
-      systemParam.apertureIndex = paramStringList[1].toInt(); 
+      lensSelect();
       apertureSelect();
       focusPosition();
+      if ( useEncoder ) {
+        encoder.setEncoderPosition( latestEncoderPosition );
+      }
       break;
-    case 'F':
+    case PHASE_FOCUS:   // Adjusting the focus position of the lens.
+      selectLensDisplay();
       labelApertureTitle->caption( TFT_WHITE, "Aperture" );
       labelFocusTitle->caption( TFT_GREEN, "Focus" );
-      nParam = argumentSeparatorString( param, paramStringList, ' ', 8 );
-      systemParam.phase = paramStringList[0].toInt(); 
-      systemParam.focusPosition = paramStringList[1].toInt(); 
+      lensSelect();
       apertureSelect();
       focusPosition();
+      if ( useEncoder ) {
+        encoder.setEncoderPosition( latestEncoderPosition );
+      }
       break;
-    case 'P':
-      nParam = argumentSeparatorString( param, paramStringList, ' ', 8 );
-      systemParam.phase = paramStringList[0].toInt(); 
-      systemParam.lensIndex = paramStringList[1].toInt(); 
-      systemParam.apertureIndex = paramStringList[2].toInt(); 
-      systemParam.focusPosition = paramStringList[3].toInt(); 
-      latestEncoderPosition = systemParam.focusPosition;
-      switch ( systemParam.phase ) {
-      case PHASE_LENS:    // Lens selection in progress.
-        lensSelect();
+    }
+//      sendBT( "P%d %d %d %d#", phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
+    break;
+  }
+  compareParam = systemParam;
+}
+
+/*************************************************************************
+ * NAME  bridgeCommand - 
+ *
+ * SYNOPSIS
+ *
+ *    void bridgeCommand( int index, int cmd, const char *param )
+ *
+ * DESCRIPTION
+ *  The command of the host on the Bluetooth serial in the bridge mode.
+ *  "P#", "Mxxxx#" and "Axx#" are queued to the lens controller of the <index> with the
+ *  commands of the local UI. The moves of the host are shown on the display
+ *  and sent to the remote as the local keys do, so the local state is kept same as the lens.
+ *  "Axx#" out of the apertures of the lens of the controller is not sent.
+ *************************************************************************/
+void bridgeCommand( int index, int cmd, const char *param )
+{
+  char buff[CMD_MAXLENGTH];
+  int value = 0;
+
+  if ( cmd != 'P' && !Tokenizer::parseInt( param, &value ) ) {
+    perserStatBT.malformed++;
+    return;
+  }
+  if ( cmd == 'A' && ( value < 0 || value >= controllerApertures( index ) ) ) {
+    perserStatBT.malformed++;
+    return;
+  }
+  if ( !bridgeActive ) {
+    bridgeActive = true;
+    labelStatus->caption( TFT_YELLOW, "Bridge to the host" );
+  }
+  switch ( cmd ) {
+  case 'P':
+    strcpy( buff, "P#" );
+    break;
+  case 'M':
+    sprintf( buff, "M%d#", value );
+    *controllerFocus( index ) = value;
+    if ( index == systemParam.controllerIndex ) {
+      focusPosition();
+      if ( connectBT ) {
+        sendRemote( "F%d %d#", systemParam.phase, systemParam.focusPosition );
+      }
+    }
+    break;
+  case 'A':
+    sprintf( buff, "A%02d#", value );
+    if ( index == systemParam.controllerIndex ) {
+      systemParam.apertureIndex = value;
+      apertureSelect();
+      if ( connectBT ) {
+        sendRemote( "A%d %d#", systemParam.phase, systemParam.apertureIndex );
+      }
+    } else {
+      controller[index].apertureIndex = value;
+    }
+    break;
+  }
+  controllerSend( index, buff, CMD_HOST );
+}
+
+// Number of the apertures of the lens of the controller of the <index>.
+int controllerApertures( int index )
+{
+  if ( index == systemParam.controllerIndex ) {
+    return selectlensInfo->numberOfAperture;
+  }
+  int count = lensLibrary.get( controller[index].lensIndex )->numberOfAperture;
+  selectlensInfo = lensLibrary.get( systemParam.lensIndex );   // The window may be read again.
+  return count;
+}
+
+// Send the reply of the lens controller back to the host.
+// The reply has the "n:" of the controller, once the host addressed the controllers by it.
+void bridgeReply( int index, String replystr )
+{
+  int position;
+  if ( Tokenizer::parseInt( replystr.c_str(), &position ) && position != *controllerFocus( index ) ) {
+    *controllerFocus( index ) = position;
+    if ( index == systemParam.controllerIndex ) {
+      focusPosition();
+      if ( connectBT ) {
+        sendRemote( "F%d %d#", systemParam.phase, systemParam.focusPosition );
+      }
+    }
+  }
+  if ( bridgeIndexed ) {
+    sendBT( "%d:%s#", index, replystr.c_str() );
+  } else {
+    sendBT( "%s#", replystr.c_str() );
+  }
+}
+
+// Print the statistics of the bridge of each controller to the serial, when the host sent any command.
+// Timer handler of every BRIDGEREPORTMS.
+void bridgeReport( void *arg )
+{
+  unsigned long hostCommands = 0;
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    hostCommands += controller[i].pipeline.stat.commands[CMD_HOST];
+  }
+  if ( hostCommands == bridgeReportCommands ) return;
+  bridgeReportCommands = hostCommands;
+
+  for ( int i = 0; i < numberOfControllers; i++ ) {
+    const pipelineStat_t *stat = &controller[i].pipeline.stat;
+    unsigned long commands = stat->commands[CMD_LOCAL] + stat->commands[CMD_HOST];
+    unsigned long replies = stat->replies[CMD_LOCAL] + stat->replies[CMD_HOST] - stat->unsolicited;
+    Serial.printf( "bridge %d host=%lu local=%lu coalesced=%lu dropped=%lu timeouts=%lu late=%lu wait avg=%luus max=%luus reply avg=%luus max=%luus\n",
+                   i, stat->commands[CMD_HOST], stat->commands[CMD_LOCAL], stat->coalesced, stat->dropped, stat->timeouts, stat->late,
+                   commands ? stat->waitUsTotal / commands : 0, stat->waitUsMax,
+                   replies ? stat->replyUsTotal / replies : 0, stat->replyUsMax );
+  }
+}
+
+// Bluetooth serial data receive
+// Stop reading when the queue is full, the rest is left in the Bluetooth serial.
+void receiveBT( void )
+{
+  sessionRecord_t rec;
+
+  if ( replayer.isReplaying() ) {
+    // The frames read by one perser of the session, as many as the queue takes.
+    // The outputs recorded on the way are fed to be compared.
+    while ( replayBTRead ) {
+      if ( !replayer.peek( &rec ) || !replayInPerserBT( rec.type ) ) {
+        replayBTRead = false;   // The record before REC_BT_END.
         break;
-      case PHASE_APERTURE:  // Aperture selection in progress.
-        selectLensDisplay();
-        labelApertureTitle->caption( TFT_GREEN, "Aperture" );
-        labelFocusTitle->caption( TFT_WHITE, "Focus" );
-        lensSelect();
-        apertureSelect();
-        focusPosition();
-        if ( useEncoder ) {
-          encoder.setEncoderPosition( latestEncoderPosition );
-        }
+      }
+      if ( rec.type == REC_BT_IN && queueBT.isFull() ) break;
+      replayer.next( &rec );
+      replayStat.records++;
+      replayStat.sessionTime = rec.time;
+      if ( rec.type == REC_BT_END ) {
+        replayBTRead = false;
+      } else if ( rec.type == REC_BT_IN ) {
+        perserStatBT.received++;
+        queueBT.push( String( (char *)rec.data ) );
+      } else {
+        replayRecord( &rec );
+      }
+    }
+    return;
+  }
+  if ( !btReady ) return;
+  while ( SerialBT.available() && !queueBT.isFull() ) {
+    if ( frameCharacter( SerialBT.read(), recvLineBT, &recvLineBTIndex ) ) {
+      perserStatBT.received++;
+      recorder.record( REC_BT_IN, recvLineBT );
+      queueBT.push( String( recvLineBT ) );
+      memset( recvLineBT, 0, RECVLINES );
+    }
+  }
+}
+
+// Returns true if the Bluetooth serial has the data to be read, or the replay has the frames of the perser left.
+bool availableBT( void )
+{
+  if ( replayer.isReplaying() ) return replayBTRead;
+  return btReady && SerialBT.available();
+}
+
+// Queries on the serial. "H#" prints the heap and stack telemetry, "S#" the message processing statistics,
+// "T#" the boot stages.
+void receiveSerial( void )
+{
+  while ( Serial.available() ) {
+    int inChar = Serial.read();
+    if ( frameCharacter( inChar, recvLineSerial, &recvLineSerialIndex ) ) {
+      switch ( recvLineSerial[0] ) {
+      case 'H':
+        memoryTask( NULL );
+        memTelemetry.report();
         break;
-      case PHASE_FOCUS:   // Adjusting the focus position of the lens.
-        selectLensDisplay();
-        labelApertureTitle->caption( TFT_WHITE, "Aperture" );
-        labelFocusTitle->caption( TFT_GREEN, "Focus" );
-        lensSelect();
-        apertureSelect();
-        focusPosition();
-        if ( useEncoder ) {
-          encoder.setEncoderPosition( latestEncoderPosition );
+      case 'S':
+        perserReport();
+        break;
+      case 'T':
+        if ( !bootTrace.isFinished() ) {
+          Serial.printf( "Boot not finished yet\n" );
         }
+        bootTrace.dump();
         break;
       }
-//      SerialBT.printf( "P%d %d %d %d#", phase, systemParam.lensIndex, systemParam.apertureIndex, systemParam.focusPosition );
-      break;
+      memset( recvLineSerial, 0, RECVLINES );
     }
-    compareParam = systemParam;
   }
+}
 
-  while ( SerialBT.available() ) {
-    char inChar = SerialBT.read();
-    if ( inChar == '#' ) {
-      recvLineBTIndex = 0;
-      queueBT.push( String( recvLineBT ) );
-      memset( recvLineBT, 0, RECVLINES );
-    } else {
-      recvLineBT[recvLineBTIndex++] = inChar;
-      if ( recvLineBTIndex >= RECVLINES ) {
-        recvLineBTIndex = RECVLINES - 1;
-      }
+// Add one character to the receive line.
+// Returns true when the frame is terminated by '#'. The caller takes the line and clears it.
+// CR and LF are dropped, and so are the spaces before and after the frame,
+// so "123\r\n#" or " 123 #" of a terminal or a controller is read as "123".
+bool frameCharacter( char inChar, char *recvLine, int *recvLineIndex )
+{
+  if ( inChar == '\r' || inChar == '\n' ) return false;
+  if ( inChar == ' ' && *recvLineIndex == 0 ) return false;
+  if ( inChar == '#' ) {
+    while ( *recvLineIndex > 0 && recvLine[*recvLineIndex - 1] == ' ' ) {
+      recvLine[--( *recvLineIndex )] = '\0';
     }
+    *recvLineIndex = 0;
+    return true;
+  }
+  recvLine[( *recvLineIndex )++] = inChar;
+  if ( *recvLineIndex >= RECVLINES - 1 ) {
+    *recvLineIndex = RECVLINES - 2;   // The last byte is kept for the terminator.
   }
+  return false;
 }
@@ -18,6 +18,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include "IniFiles.h"
+#include "tokenizer.h"
 #define LINES_MAX 100
 
 // IniFiles class constructor.
@@ -175,23 +176,18 @@ String IniFiles::readString( String key, String defaultval )
 int IniFiles::readDelimitedString( String key, char delimiter, int listSize, String *stringList )
 {
   String inString = readString( key, "" );
-  int n = inString.length();
-  if ( n == 0 ) return 0;
-  
+  if ( inString.length() == 0 ) return 0;
+
+  Tokenizer tokens( inString.c_str(), inString.length(), delimiter, false );
+  tokenView_t token;
   int index = 0;
   for ( int i = 0; i < listSize; i++ ) {
     stringList[i] = "";
   }
-  for ( int i = 0; i < n; i++ ) {
-    char c = inString.charAt( i );
-    if ( c == delimiter ) {
-      index++;
-      if ( index >= listSize ) return listSize;
-    } else {
-      stringList[index] += c;
-    }
+  while ( index < listSize && tokens.next( &token ) ) {
+    stringList[index++] = Tokenizer::toString( &token );
   }
-  return index + 1;	 // Returns the number of delimited strings stored.
+  return index;	 // Returns the number of delimited strings stored.
 }
 
 // Reads the numerical floating point data(as double) of the argument <key>.
@@ -0,0 +1,299 @@
+// benchmark
+
+/*
+  benchmark.ino
+    Microbenchmarks of the parsing, the configuration file and the queue.
+    Enabled by "#define BENCHMARK" in CanonLensControllerMarkII_M5Stack_BT.ino, and run in setup().
+    One line is printed to the serial for each benchmark, so the results can be compared between versions.
+    The names of the lines are kept between versions. argumentSeparator_lens and argumentSeparator_msg run
+    a copy of argumentSeparatorString(), the parser before the tokenizer, as the baseline of tokenize_lens
+    and tokenize_msg.
+
+      bench <name> iterations=<n> ns/op=<n> allocs/op=<n> bytes/op=<n> peak=<n>
+
+    allocs/op and bytes/op are counted by the heap hooks of ESP-IDF (CONFIG_HEAP_USE_HOOKS) in memTelemetry.
+    Without the hooks they are the net blocks and bytes kept by one operation, from the heap in use
+    before and after, and are marked "(net)". An allocation freed in the operation is not counted then.
+    peak is the largest heap in use above the start of the benchmark, sampled after each operation.
+    focus_redraw_font and focus_redraw_glyph compare the redraw of the focus position by the font
+    and by the glyph cache. Their ns/op is mostly the time of the SPI to the LCD, so they are
+    meaningful only on the device.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#ifdef BENCHMARK
+
+#include <esp_heap_caps.h>
+
+#define BENCH_INIFILENAME   "/bench.ini"
+#define BENCH_LENSFILENAME  "/benchLens.txt"
+#define BENCH_LENSES        200   // number of lenses of the large lens file
+#define BENCH_INILINES      16
+
+const char benchApertureLine[] = "1.8 2.0 2.2 2.5 2.8 3.2 3.5 4.0 4.5 5.0 5.6 6.3 7.1 8 9 10 11 13 14 16 18 20 22";
+const char benchMessage[] = "3 12 5 4800";
+const char benchMacAddress[] = "24:0A:C4:12:AB:EF";
+const char benchBurstBT[] = "f4801#f4802#f4803#f4804#f4805#f4806#f4807#f4808#K4#K0#f4809#f4810#F3 4810#A2 5#L1 3#P3 3 5 4810#";
+const char benchBurstUSB[] = "4800#4801#4802#4803#4804#4805#4806#4807#4808#4809#4810#4811#";
+
+String benchList[32];
+StringQueue benchQueue( QUEUELENGTH );
+LensLibrary benchLibrary;
+char benchLine[RECVLINES];
+int benchLineIndex;
+volatile int benchSink;
+LabelEx *benchLabel;
+GlyphCache benchGlyphs;
+
+// Run the <func> <iterations> times, and print the result.
+void benchRun( const char *name, int iterations, void (*func)( int iteration ) )
+{
+  multi_heap_info_t info;
+
+  // Time and allocations
+  uint32_t allocCount = memTelemetry.totalAllocs();
+  uint32_t allocBytes = memTelemetry.totalBytes();
+  unsigned long start = micros();
+  for ( int i = 0; i < iterations; i++ ) {
+    func( i );
+  }
+  unsigned long elapsed = micros() - start;
+  allocCount = memTelemetry.totalAllocs() - allocCount;
+  allocBytes = memTelemetry.totalBytes() - allocBytes;
+
+  // Peak of the heap in use, sampled after each operation.
+  heap_caps_get_info( &info, MALLOC_CAP_DEFAULT );
+  size_t base = info.total_allocated_bytes;
+  size_t peak = 0;
+  for ( int i = 0; i < iterations; i++ ) {
+    func( i );
+    heap_caps_get_info( &info, MALLOC_CAP_DEFAULT );
+    if ( info.total_allocated_bytes > base + peak ) {
+      peak = info.total_allocated_bytes - base;
+    }
+  }
+
+  char allocStr[16], bytesStr[16];
+#ifdef CONFIG_HEAP_USE_HOOKS
+  sprintf( allocStr, "%.1f", (double)allocCount / iterations );
+  sprintf( bytesStr, "%lu", (unsigned long)( allocBytes / iterations ) );
+#else
+  sprintf( allocStr, "%.1f(net)", (double)(int32_t)allocCount / iterations );
+  sprintf( bytesStr, "%ld(net)", (long)(int32_t)allocBytes / iterations );
+#endif
+  Serial.printf( "bench %-24s iterations=%d ns/op=%lu allocs/op=%s bytes/op=%s peak=%u\n",
+                 name, iterations, (unsigned long)( (uint64_t)elapsed * 1000 / iterations ), allocStr, bytesStr, (unsigned)peak );
+}
+
+// argumentSeparatorString() of the sketch before the tokenizer, kept here as the baseline.
+int benchArgumentSeparatorString( String inString, String *StringList, int separator, int maxElements )
+{
+  int n = 0;
+  int s1;
+  
+  // Parse an inString.
+  while ( inString.length() > 0 ) {
+    s1 = inString.indexOf( separator );  // Find the separator in the string.
+    if ( s1 > 0 ) {
+      StringList[n++] = inString.substring( 0, s1 );
+      inString.remove( 0, s1 + 1 );
+      if ( n >= maxElements ) return n;
+    } else {
+      StringList[n++] = inString;
+      break;          
+    }
+  }
+  return n;
+}
+
+void benchArgumentSeparatorAperture( int iteration )
+{
+  benchSink = benchArgumentSeparatorString( benchApertureLine, benchList, ' ', 32 );
+}
+
+void benchArgumentSeparatorMessage( int iteration )
+{
+  benchSink = benchArgumentSeparatorString( benchMessage, benchList, ' ', 8 );
+}
+
+void benchTokenizeAperture( int iteration )
+{
+  Tokenizer tokens( benchApertureLine, ' ' );
+  int fnumber;
+  int n = 0;
+  while ( tokens.nextFixed( &fnumber, 1 ) ) n++;
+  benchSink = n;
+}
+
+void benchTokenizeMessage( int iteration )
+{
+  Tokenizer tokens( benchMessage, ' ' );
+  int value;
+  int n = 0;
+  while ( tokens.nextInt( &value ) ) n += value;
+  benchSink = n;
+}
+
+void benchParseLedColor( int iteration )
+{
+  ledColorInfo_t color;
+  parseLedColor( "32 64 0", &color );
+  benchSink = color.colorGreen;
+}
+
+void benchDecodeMacAddress( int iteration )
+{
+  uint8_t macaddr[6];
+  decodeMacAddressString( benchMacAddress, macaddr );
+  benchSink = macaddr[5];
+}
+
+void benchAtox2( int iteration )
+{
+  benchSink = atox2( &benchMacAddress[( iteration % 6 ) * 3] );
+}
+
+void benchQueuePushPop( int iteration )
+{
+  benchQueue.push( "f4800" );
+  benchSink = benchQueue.pop().length();
+}
+
+void benchIniCycle( int iteration )
+{
+  IniFiles ini( BENCH_INILINES );
+  ini.open( SD, BENCH_INIFILENAME );
+  benchSink = ini.readString( "ledColorIndicator10", "" ).length();
+  ini.writeInteger( "LensIndex", iteration );
+  ini.close( SD );
+}
+
+void benchLensOpen( int iteration )
+{
+  benchLibrary.open( SD, BENCH_LENSFILENAME );
+  benchSink = benchLibrary.count();
+}
+
+void benchLensGet( int iteration )
+{
+  benchSink = benchLibrary.get( ( iteration * 37 ) % BENCH_LENSES )->numberOfAperture;
+}
+
+// The '#' framing of a burst of frames, as receiveBT() and perserBT() do.
+void benchFrameBurst( const char *burst, StringQueue *queue )
+{
+  for ( const char *p = burst; *p; p++ ) {
+    if ( frameCharacter( *p, benchLine, &benchLineIndex ) ) {
+      queue->push( String( benchLine ) );
+      memset( benchLine, 0, RECVLINES );
+    }
+  }
+  while ( queue->count() > 0 ) {
+    benchSink = queue->pop().length();
+  }
+}
+
+void benchFrameBurstBT( int iteration )
+{
+  benchFrameBurst( benchBurstBT, &benchQueue );
+}
+
+void benchFrameBurstUSB( int iteration )
+{
+  benchFrameBurst( benchBurstUSB, &benchQueue );
+}
+
+// Redraw of the focus position, drawn by the font with the frame every time. (the former focusPosition())
+void benchFocusRedrawFont( int iteration )
+{
+  benchLabel->frameRect( TFT_WHITE, TFT_RED, 4 );
+  benchLabel->caption( TFT_WHITE, "%d", 4800 + iteration );
+}
+
+// Redraw of the focus position, as focusPosition() does.
+void benchFocusRedraw( int iteration )
+{
+  if ( !benchLabel->isFramed( TFT_RED ) ) {
+    benchLabel->frameRect( TFT_WHITE, TFT_RED, 4 );
+  }
+  benchLabel->caption( TFT_WHITE, "%d", 4800 + iteration );
+}
+
+// Make the files for the benchmarks on the micro SD card.
+void benchMakeFiles( void )
+{
+  File file = SD.open( BENCH_INIFILENAME, FILE_WRITE );
+  if ( file ) {
+    file.println( "LensIndex=0" );
+    file.println( "ledColorConnect=0 0 255" );
+    file.println( "ledColorIndicator1=32 64 0" );
+    file.println( "ledColorIndicator10=64 0 0" );
+    file.close();
+  }
+  file = SD.open( BENCH_LENSFILENAME, FILE_WRITE );
+  if ( file ) {
+    const int focal[] = { 14, 20, 24, 35, 50, 85, 100, 135, 200, 300, 400, 600 };
+    for ( int i = 0; i < BENCH_LENSES; i++ ) {
+      file.printf( "lens%d=Benchmark %dmm F2.8 No.%d | %s\n", i + 1, focal[i % 12], i + 1, benchApertureLine );
+    }
+    file.close();
+  }
+}
+
+/*************************************************************************
+ * NAME  runBenchmarks -
+ *
+ * SYNOPSIS
+ *
+ *    void runBenchmarks( void )
+ *
+ * DESCRIPTION
+ *  Run all of the benchmarks and print the results to the serial.
+ *************************************************************************/
+void runBenchmarks( void )
+{
+  Serial.printf( "bench start free=%u largest=%u\n", heap_caps_get_free_size( MALLOC_CAP_DEFAULT ), heap_caps_get_largest_free_block( MALLOC_CAP_DEFAULT ) );
+  benchMakeFiles();
+  benchLineIndex = 0;
+  memset( benchLine, 0, RECVLINES );
+
+  benchRun( "argumentSeparator_lens", 1000, benchArgumentSeparatorAperture );
+  benchRun( "argumentSeparator_msg", 1000, benchArgumentSeparatorMessage );
+  benchRun( "tokenize_lens", 1000, benchTokenizeAperture );
+  benchRun( "tokenize_msg", 1000, benchTokenizeMessage );
+  benchRun( "parseLedColor", 1000, benchParseLedColor );
+  benchRun( "decodeMacAddress", 10000, benchDecodeMacAddress );
+  benchRun( "atox2", 10000, benchAtox2 );
+  benchRun( "queue_push_pop", 10000, benchQueuePushPop );
+  benchRun( "ini_cycle", 20, benchIniCycle );
+  benchRun( "lens_open_200", 5, benchLensOpen );
+  benchRun( "lens_get_paged", 200, benchLensGet );
+  benchRun( "frame_burst_bt", 1000, benchFrameBurstBT );
+  benchRun( "frame_burst_usb", 1000, benchFrameBurstUSB );
+
+  benchLabel = new LabelEx( 64, 120, 150, 48 );
+  benchLabel->alignment = taRightJustify;
+  benchLabel->textSize = NUMERALFONT;
+  benchLabel->textBaseOffset = -4;
+  benchRun( "focus_redraw_font", 200, benchFocusRedrawFont );
+  if ( benchGlyphs.begin( NUMERALFONT, GLYPH_MAXBYTES ) ) {
+    benchLabel->setGlyphCache( &benchGlyphs );
+    benchRun( "focus_redraw_glyph", 200, benchFocusRedraw );
+    Serial.printf( "bench glyph cache %u bytes, blits=%lu skips=%lu\n", benchGlyphs.size(), benchGlyphs.blits, benchGlyphs.skips );
+    benchGlyphs.end();
+  } else {
+    Serial.printf( "bench focus_redraw_glyph skipped, no glyph of the font %d is cached\n", NUMERALFONT );
+  }
+  delete benchLabel;
+
+  SD.remove( BENCH_INIFILENAME );
+  SD.remove( BENCH_LENSFILENAME );
+  Serial.printf( "bench end free=%u largest=%u\n", heap_caps_get_free_size( MALLOC_CAP_DEFAULT ), heap_caps_get_largest_free_block( MALLOC_CAP_DEFAULT ) );
+}
+
+#endif  /* BENCHMARK */
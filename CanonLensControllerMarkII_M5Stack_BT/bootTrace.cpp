@@ -0,0 +1,86 @@
+// bootTrace
+
+/*
+  bootTrace.cpp
+    BootTrace keeps the stages in the mark order, and sorts them by the time only for the dump.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "bootTrace.h"
+
+// BootTrace class constructor.
+BootTrace::BootTrace()
+{
+  count = 0;
+  finished = false;
+}
+
+// BootTrace class destructor.
+BootTrace::~BootTrace()
+{
+}
+
+void BootTrace::mark( const char *name )
+{
+  mark( name, micros() );
+}
+
+// Record the stage ended at the <us>.
+void BootTrace::mark( const char *name, unsigned long us )
+{
+  if ( count >= BOOT_MAXSTAGES ) return;
+  stage[count].name = name;
+  stage[count].us = us;
+  count++;
+}
+
+// Record the stage the boot is usable. Returns true only at the first time.
+bool BootTrace::finish( const char *name )
+{
+  if ( finished ) return false;
+  mark( name );
+  finished = true;
+  return true;
+}
+
+bool BootTrace::isFinished( void )
+{
+  return finished;
+}
+
+// Time from the reset to the last stage.
+unsigned long BootTrace::elapsedUs( void )
+{
+  unsigned long us = 0;
+  for ( int i = 0; i < count; i++ ) {
+    if ( stage[i].us > us ) us = stage[i].us;
+  }
+  return us;
+}
+
+// Print the stages in the time order, with the time from the previous stage.
+void BootTrace::dump( void )
+{
+  bootStage_t sorted[BOOT_MAXSTAGES];
+  memcpy( sorted, stage, sizeof( bootStage_t ) * count );
+  for ( int i = 1; i < count; i++ ) {
+    bootStage_t s = sorted[i];
+    int j = i;
+    for ( ; j > 0 && sorted[j - 1].us > s.us; j-- ) {
+      sorted[j] = sorted[j - 1];
+    }
+    sorted[j] = s;
+  }
+  unsigned long previous = 0;
+  Serial.printf( "boot stages (ms from the reset)\n" );
+  for ( int i = 0; i < count; i++ ) {
+    Serial.printf( "  %8lu.%03lu  +%6lu.%03lu  %s\n", sorted[i].us / 1000, sorted[i].us % 1000,
+                   ( sorted[i].us - previous ) / 1000, ( sorted[i].us - previous ) % 1000, sorted[i].name );
+    previous = sorted[i].us;
+  }
+}
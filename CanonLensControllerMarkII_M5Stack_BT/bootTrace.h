@@ -0,0 +1,51 @@
+// bootTrace
+
+/*
+  bootTrace.h
+    Timestamps of the boot stages, kept to be dumped after the startup and on request.
+    The stages done by the other task give their own time to mark(), and the dump is in the time order.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  mark()      Record the time of the stage. (micros() from the reset)
+  finish()    Record the last stage, the boot is usable.
+  dump()      Print the stages to the serial.
+*/
+
+#ifndef BOOTTRACE_H
+#define BOOTTRACE_H
+
+#include <Arduino.h>
+
+#define BOOT_MAXSTAGES  16    // number of the stages recorded
+
+typedef struct {
+  const char *name;
+  unsigned long us;           // micros() at the end of the stage
+} bootStage_t;
+
+class BootTrace
+{
+private:
+  bootStage_t stage[BOOT_MAXSTAGES];
+  int count;
+  bool finished;
+
+public:
+  BootTrace();
+  ~BootTrace();
+
+  void mark( const char *name );
+  void mark( const char *name, unsigned long us );
+  bool finish( const char *name );
+  bool isFinished( void );
+  unsigned long elapsedUs( void );
+  void dump( void );
+};
+
+#endif  /* BOOTTRACE_H */
@@ -112,6 +112,12 @@ LabelEx::LabelEx( uint16_t x_, uint16_t y_, uint16_t w_, uint16_t h_ )
   alignment = taLeftJustify;
   textSize = 1;
   textBaseOffset = 0;
+  bFillColor = TFT_BLACK;
+  bRadius = 0;
+  framed = false;
+  captionStr[0] = '\0';
+  glyphCache = NULL;
+  GlyphCache::invalidate( &glyphLine, GLYPH_DIRTY );
   bx = x_;
   by = y_;
   bw = w_;
@@ -137,6 +143,8 @@ void LabelEx::caption( uint16_t textColor, char* fmt, ... )
 void LabelEx::caption( uint16_t textColor, String captionStr )
 {
   int cx1, cy1;
+  if ( glyphCache != NULL && drawGlyphs( textColor, captionStr.c_str() ) ) return;
+  GlyphCache::invalidate( &glyphLine, GLYPH_DIRTY );
   cy1 = cy - M5.Lcd.fontHeight( textSize ) / 2; 
   cy1 -= textBaseOffset;
   M5.Lcd.fillRoundRect( bx+1, by+1, bw-2, bh-2, bRadius, bFillColor );
@@ -158,6 +166,48 @@ void LabelEx::caption( uint16_t textColor, String captionStr )
 //  Serial.printf( "fontHeight=%d cx=%d, cy1=%d, %s\n", M5.Lcd.fontHeight( textSize ), cx1, cy1, captionStr );
 }
 
+// Draw the caption by the glyph cache. Only the changed characters are drawn.
+// Returns false if the caption can not be drawn by the cache, and the font is used.
+bool LabelEx::drawGlyphs( uint16_t textColor, const char *str )
+{
+  int width = glyphCache->textWidth( str, textSize );
+  if ( width < 0 ) return false;
+  int x1;
+  switch ( alignment ) {
+    case taCenter:
+      x1 = cx - width / 2;
+      break;
+    case taRightJustify:
+      x1 = bx + bw - 2 - width;   // Inside of the frame.
+      break;
+    default:
+      x1 = bx + 2;
+      break;
+  }
+  int y1 = cy - M5.Lcd.fontHeight( textSize ) / 2 - textBaseOffset;
+  if ( x1 < bx + 1 || x1 + width > bx + bw - 1 ) return false;
+  if ( !glyphCache->fits( y1, by + 1 + bRadius, by + bh - 1 - bRadius ) ) return false;
+  if ( glyphLine.count == GLYPH_DIRTY ) {
+    M5.Lcd.fillRoundRect( bx+1, by+1, bw-2, bh-2, bRadius, bFillColor );
+    GlyphCache::invalidate( &glyphLine, GLYPH_FILLED );
+  }
+  glyphCache->drawString( str, x1, y1, textColor, bFillColor, &glyphLine );
+  return true;
+}
+
+// Use the glyph cache for the caption. NULL to use the font.
+void LabelEx::setGlyphCache( GlyphCache *cache )
+{
+  glyphCache = cache;
+  GlyphCache::invalidate( &glyphLine, GLYPH_DIRTY );
+}
+
+// Returns true if the frame is drawn with the <fillColor>.
+bool LabelEx::isFramed( uint16_t fillColor )
+{
+  return framed && (uint16_t)bFillColor == fillColor;
+}
+
 void LabelEx::frameRect( uint16_t frameColor, uint16_t fillColor )
 {
   frameRect( frameColor, fillColor, 1 );
@@ -172,4 +222,6 @@ void LabelEx::frameRect( uint16_t frameColor, uint16_t fillColor, int16_t radius
   M5.Lcd.fillRoundRect( bx+1, by+1, bw-2, bh-2, bRadius, bFillColor );
   M5.Lcd.setTextColor( frameColor );
   M5.Lcd.drawCentreString( captionStr, cx, cy1, captionTextSize );
+  framed = true;
+  GlyphCache::invalidate( &glyphLine, GLYPH_FILLED );
 }
@@ -18,6 +18,7 @@
 #define _BUTTONEX_H_
 
 #include <M5Stack.h>
+#include "glyphCache.h"
 
 #define taLeftJustify   0	// Text alignment Left-aligned
 #define taCenter        1	// Text alignment center-aligned
@@ -59,6 +60,8 @@ class LabelEx {
     void frameRect( uint16_t frameColor, uint16_t fillColor, int16_t radius );
     void caption( uint16_t textColor, char* fmt, ... );
     void caption( uint16_t textColor, String captionStr );
+    void setGlyphCache( GlyphCache *cache );
+    bool isFramed( uint16_t fillColor );
     int16_t alignment;
     int16_t tag;
     int16_t textBaseOffset;
@@ -68,8 +71,12 @@ class LabelEx {
     int16_t cx, cy;
     int16_t bFillColor;
     int16_t bRadius;
+    bool framed;
     uint8_t captionTextSize;
     char captionStr[32];
+    GlyphCache *glyphCache;
+    glyphLine_t glyphLine;
+    bool drawGlyphs( uint16_t textColor, const char *str );
 };
 
 #endif
@@ -0,0 +1,176 @@
+// commandPipeline
+
+/*
+  commandPipeline.cpp
+    CommandPipeline is a ring of the commands. The timeout of "P#" is checked in ready(), so no timer is needed.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "commandPipeline.h"
+
+// CommandPipeline class constructor.
+CommandPipeline::CommandPipeline()
+{
+  clear();
+  memset( &stat, 0, sizeof( stat ) );
+}
+
+// CommandPipeline class destructor.
+CommandPipeline::~CommandPipeline()
+{
+}
+
+// Remove all of the commands, and stop waiting for the reply.
+void CommandPipeline::clear( void )
+{
+  head = 0;
+  count = 0;
+  awaiting = false;
+  awaitingOwner = CMD_LOCAL;
+  late = false;
+  lateOwner = CMD_LOCAL;
+  sentUs = 0;
+  holding = false;
+  holdUs = 0;
+}
+
+// Queue the <command> of the <owner>. Returns false if the queue is full.
+// "M" and "A" replace the same command of the same owner at the tail,
+// because only the latest position and aperture have a meaning.
+bool CommandPipeline::push( const char *command, uint8_t owner )
+{
+  if ( count > 0 ) {
+    lensCommand_t *tail = &queue[( head + count - 1 ) % CMD_QUEUELENGTH];
+    if ( tail->owner == owner && tail->command[0] == command[0] && ( command[0] == 'M' || command[0] == 'A' ) ) {
+      strncpy( tail->command, command, CMD_MAXLENGTH - 1 );
+      tail->command[CMD_MAXLENGTH - 1] = '\0';
+      stat.coalesced++;
+      return true;
+    }
+  }
+  if ( count >= CMD_QUEUELENGTH ) {
+    stat.dropped++;
+    return false;
+  }
+  lensCommand_t *cmd = &queue[( head + count ) % CMD_QUEUELENGTH];
+  strncpy( cmd->command, command, CMD_MAXLENGTH - 1 );
+  cmd->command[CMD_MAXLENGTH - 1] = '\0';
+  cmd->owner = owner;
+  cmd->queuedUs = micros();
+  count++;
+  return true;
+}
+
+// Queue the <command> of the <owner> in front of the others. Returns false if the queue is full.
+bool CommandPipeline::pushFront( const char *command, uint8_t owner )
+{
+  if ( count >= CMD_QUEUELENGTH ) {
+    stat.dropped++;
+    return false;
+  }
+  head = ( head + CMD_QUEUELENGTH - 1 ) % CMD_QUEUELENGTH;
+  lensCommand_t *cmd = &queue[head];
+  strncpy( cmd->command, command, CMD_MAXLENGTH - 1 );
+  cmd->command[CMD_MAXLENGTH - 1] = '\0';
+  cmd->owner = owner;
+  cmd->queuedUs = micros();
+  count++;
+  return true;
+}
+
+// Hold "P#" and the commands of the host until the <untilUs>, the lens is expected to be moving.
+// The moves of the local UI go at once, they change the target of the move.
+void CommandPipeline::hold( unsigned long untilUs )
+{
+  holding = true;
+  holdUs = untilUs;
+}
+
+void CommandPipeline::release( void )
+{
+  holding = false;
+}
+
+// Returns true if the front command can be sent now.
+// "P#" waits for the reply of the last "P#", the others have no reply and are sent at once.
+// The reply not received in CMD_REPLYTIMEOUTMS is given up, but the owner is kept for the late reply.
+bool CommandPipeline::ready( unsigned long nowUs )
+{
+  if ( awaiting && ( nowUs - sentUs ) >= CMD_REPLYTIMEOUTMS * 1000UL ) {
+    awaiting = false;
+    late = true;
+    lateOwner = awaitingOwner;
+    stat.timeouts++;
+  }
+  if ( holding && (long)( nowUs - holdUs ) >= 0 ) {
+    holding = false;
+  }
+  if ( count == 0 ) return false;
+  const lensCommand_t *cmd = &queue[head];
+  if ( holding && cmd->owner != CMD_MOTION && ( cmd->command[0] == 'P' || cmd->owner == CMD_HOST ) ) {
+    return false;
+  }
+  return !awaiting || cmd->command[0] != 'P';
+}
+
+const lensCommand_t *CommandPipeline::front( void )
+{
+  return ( count > 0 ) ? &queue[head] : NULL;
+}
+
+// Remove the front command after it is sent to the lens controller.
+void CommandPipeline::sent( unsigned long nowUs )
+{
+  if ( count == 0 ) return;
+  lensCommand_t *cmd = &queue[head];
+  unsigned long waitUs = nowUs - cmd->queuedUs;
+  stat.commands[cmd->owner]++;
+  stat.waitUsTotal += waitUs;
+  if ( waitUs > stat.waitUsMax ) stat.waitUsMax = waitUs;
+  if ( cmd->command[0] == 'P' ) {
+    awaiting = true;
+    awaitingOwner = cmd->owner;
+    late = false;     // The next reply can not be told from the late one, it goes to the new "P#".
+    sentUs = nowUs;
+  }
+  head = ( head + 1 ) % CMD_QUEUELENGTH;
+  count--;
+}
+
+// Returns the owner of the reply received.
+// The reply of the "P#" timed out is given to its owner, and a reply without "P#" is given to the local.
+int CommandPipeline::reply( unsigned long nowUs )
+{
+  if ( !awaiting && late ) {
+    late = false;
+    stat.late++;
+    return lateOwner;
+  }
+  if ( !awaiting ) {
+    stat.unsolicited++;
+    stat.replies[CMD_LOCAL]++;
+    return CMD_LOCAL;
+  }
+  unsigned long replyUs = nowUs - sentUs;
+  stat.replyUsTotal += replyUs;
+  if ( replyUs > stat.replyUsMax ) stat.replyUsMax = replyUs;
+  stat.replies[awaitingOwner]++;
+  awaiting = false;
+  return awaitingOwner;
+}
+
+bool CommandPipeline::isAwaiting( void )
+{
+  return awaiting;
+}
+
+// The owner of the reply awaited, or -1 if no reply is awaited.
+int CommandPipeline::awaitedOwner( void )
+{
+  return awaiting ? awaitingOwner : -1;
+}
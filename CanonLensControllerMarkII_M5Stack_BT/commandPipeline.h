@@ -0,0 +1,97 @@
+// commandPipeline
+
+/*
+  commandPipeline.h
+    One queue of the commands to the lens controller, shared by the local UI and the host
+    on the Bluetooth serial (bridge mode). The commands are sent one by one in the order
+    they are queued, and only "P#" has a reply. While a reply is awaited the next "P#"
+    (and the commands after it) is not sent, so the reply is always given to the owner of the "P#".
+    While the lens is expected to be moving (hold()), "P#" and the commands of the host are held,
+    so they do not land in the middle of the move. The probe of the move goes first. (pushFront())
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  push()      Queue the command. A move or an aperture replaces the same one of the owner at the tail.
+  pushFront() Queue the command in front of the others. (the probe of the move)
+  hold()      Hold "P#" and the commands of the host until the time.
+  release()   Stop holding.
+  ready()     Returns true if the front command can be sent now.
+  front()     The command to be sent.
+  sent()      Remove the front command after it is sent, and wait for the reply of "P#".
+  reply()     Returns the owner of the reply received. A reply after the timeout goes to the owner of the "P#".
+  awaitedOwner() The owner of the reply awaited, or -1.
+*/
+
+#ifndef COMMANDPIPELINE_H
+#define COMMANDPIPELINE_H
+
+#include <Arduino.h>
+
+#define CMD_LOCAL           0     // The command of the local UI (and of the remote).
+#define CMD_HOST            1     // The command of the host on the Bluetooth serial.
+#define CMD_MOTION          2     // The probe of the move, for the timing model of the lens.
+#define CMD_OWNERS          3
+
+#define CMD_QUEUELENGTH     16    // number of commands that can be queued
+#define CMD_MAXLENGTH       12    // max length of a command including '#'
+#define CMD_REPLYTIMEOUTMS  500   // The reply of "P#" is given up after this time.
+
+typedef struct {
+  char command[CMD_MAXLENGTH];
+  uint8_t owner;
+  unsigned long queuedUs;
+} lensCommand_t;
+
+typedef struct {
+  unsigned long commands[CMD_OWNERS];   // Commands sent, of each owner.
+  unsigned long coalesced;      // Commands replaced by a newer one of the same owner.
+  unsigned long dropped;        // Commands lost because the queue was full.
+  unsigned long replies[CMD_OWNERS];    // Replies given to each owner.
+  unsigned long unsolicited;    // Replies received without "P#".
+  unsigned long timeouts;       // "P#" without the reply.
+  unsigned long late;           // Replies received after the timeout, given to the owner of the "P#". (not in replies[])
+  unsigned long waitUsTotal;    // Time from push() to sent(). (the overhead of the queue)
+  unsigned long waitUsMax;
+  unsigned long replyUsTotal;   // Time from sent() of "P#" to reply().
+  unsigned long replyUsMax;
+} pipelineStat_t;
+
+class CommandPipeline
+{
+private:
+  lensCommand_t queue[CMD_QUEUELENGTH];
+  int head;
+  int count;
+  bool awaiting;
+  uint8_t awaitingOwner;
+  bool late;                    // The last "P#" timed out, and its reply may still come.
+  uint8_t lateOwner;
+  unsigned long sentUs;
+  bool holding;
+  unsigned long holdUs;         // micros() the lens is expected to stop.
+
+public:
+  CommandPipeline();
+  ~CommandPipeline();
+
+  pipelineStat_t stat;
+
+  void clear( void );
+  bool push( const char *command, uint8_t owner );
+  bool pushFront( const char *command, uint8_t owner );
+  void hold( unsigned long untilUs );
+  void release( void );
+  bool ready( unsigned long nowUs );
+  const lensCommand_t *front( void );
+  void sent( unsigned long nowUs );
+  int reply( unsigned long nowUs );
+  bool isAwaiting( void );
+  int awaitedOwner( void );
+};
+
+#endif  /* COMMANDPIPELINE_H */
@@ -22,6 +22,9 @@ bool facesEncoder::check( void )
 {
   currentPosition = 0;
   incrementMultiplier = 1;
+  pendingRingLight = 0;
+  writeTime = 0;
+  pattern = NULL;
   for ( int index = 0; index < Faces_Encoder_RingLight_Count; index++ ) {
     currentRingLight[index].colorRed = 0;
     currentRingLight[index].colorGreen = 0;
@@ -71,19 +74,14 @@ bool facesEncoder::buttonIsPressed( void )
   return encoderButton ? false : true;
 }
 
+// Set the color of the LED. It is written by ringLightTask(), RINGLIGHT_INTERVALMS apart.
 uint8_t facesEncoder::ringLight( int index, uint8_t r, uint8_t g, uint8_t b )
 {
   if ( ( currentRingLight[index].colorRed != r ) || ( currentRingLight[index].colorGreen != g ) || ( currentRingLight[index].colorBlue != b ) ) {
     currentRingLight[index].colorRed = r;
     currentRingLight[index].colorGreen = g;
     currentRingLight[index].colorBlue = b;
-    delay( 5 );   // Latency for continuous access
-    Wire.beginTransmission( addr );
-    Wire.write( index );
-    Wire.write( r );
-    Wire.write( g );
-    Wire.write( b );
-    return Wire.endTransmission();
+    pendingRingLight |= ( 1 << index );
   }
   return 0;
 }
@@ -95,23 +93,76 @@ void facesEncoder::ringLight( uint8_t r, uint8_t g, uint8_t b )
   }
 }
 
+// Start the playback of the pattern. Each step is shown for <delayTime> after it is written.
 void facesEncoder::ringLight( uint16_t *patternTable, uint16_t delayTime, uint8_t r, uint8_t g, uint8_t b )
 {
-  for ( int n = 0; n < 100; n++ ) {
-    uint16_t pattern = patternTable[n];
-    if ( pattern == RINGLIGHT_BIT_END ) return;
-
-    uint16_t mbit = RINGLIGHT_BIT0;
-    for ( int index = 0; index < Faces_Encoder_RingLight_Count; index++ ) {
-      if ( pattern & mbit ) {
-        ringLight( index, r, g, b );
-      } else {
-        ringLight( index, 0, 0, 0 );
-      }
-      mbit <<= 1;
+  pattern = patternTable;
+  patternStep = 0;
+  patternDelay = delayTime;
+  patternColor.colorRed = r;
+  patternColor.colorGreen = g;
+  patternColor.colorBlue = b;
+  patternNextStep();
+}
+
+// Set the LEDs of the next step of the pattern.
+void facesEncoder::patternNextStep( void )
+{
+  uint16_t bits = ( patternStep < 100 ) ? pattern[patternStep++] : RINGLIGHT_BIT_END;
+  if ( bits == RINGLIGHT_BIT_END ) {
+    pattern = NULL;
+    return;
+  }
+  uint16_t mbit = RINGLIGHT_BIT0;
+  for ( int index = 0; index < Faces_Encoder_RingLight_Count; index++ ) {
+    if ( bits & mbit ) {
+      ringLight( index, patternColor );
+    } else {
+      ringLight( index, 0, 0, 0 );
+    }
+    mbit <<= 1;
+  }
+  patternTime = millis() + patternDelay;
+}
+
+uint8_t facesEncoder::writeRingLight( int index )
+{
+  Wire.beginTransmission( addr );
+  Wire.write( index );
+  Wire.write( currentRingLight[index].colorRed );
+  Wire.write( currentRingLight[index].colorGreen );
+  Wire.write( currentRingLight[index].colorBlue );
+  return Wire.endTransmission();
+}
+
+// Write one LED changed, and go to the next step of the pattern when it is time.
+// Call it every RINGLIGHT_INTERVALMS. Returns true while anything is left.
+bool facesEncoder::ringLightTask( unsigned long now )
+{
+  if ( pendingRingLight ) {
+    if ( (long)( now - writeTime ) < RINGLIGHT_INTERVALMS ) return true;
+    int index = 0;
+    while ( !( pendingRingLight & ( 1 << index ) ) ) index++;
+    pendingRingLight &= ~( 1 << index );
+    writeRingLight( index );
+    writeTime = now;
+    if ( pendingRingLight == 0 && pattern ) {
+      patternTime = now + patternDelay;   // The step is shown after all of the LEDs are written.
     }
-    delay( delayTime );
+    return true;
   }
+  if ( pattern ) {
+    if ( (long)( now - patternTime ) >= 0 ) {
+      patternNextStep();
+    }
+    return true;
+  }
+  return false;
+}
+
+bool facesEncoder::ringLightBusy( void )
+{
+  return pendingRingLight || pattern;
 }
 
 uint8_t facesEncoder::ringLight( int index, ledColorInfo_t ledColor )
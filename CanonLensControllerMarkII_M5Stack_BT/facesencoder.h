@@ -34,6 +34,7 @@
 #define RINGLIGHT_BIT10 0x0400
 #define RINGLIGHT_BIT11 0x0800
 #define RINGLIGHT_BIT_END 0xFFFF
+#define RINGLIGHT_INTERVALMS  5   // Latency for continuous access
 
 #ifdef  __cplusplus
 extern "C" {
@@ -55,8 +56,17 @@ private:
   int16_t incrementMultiplier;
   int16_t currentPosition;
   ledColorInfo_t currentRingLight[Faces_Encoder_RingLight_Count];
+  uint16_t pendingRingLight;      // LEDs not written yet. (RINGLIGHT_BIT*)
+  unsigned long writeTime;
+  const uint16_t *pattern;        // Pattern in playback, or NULL.
+  int patternStep;
+  uint16_t patternDelay;
+  unsigned long patternTime;      // Time of the next step.
+  ledColorInfo_t patternColor;
 
   bool getEncoderValue( void );
+  uint8_t writeRingLight( int index );
+  void patternNextStep( void );
 public:
   facesEncoder();
   facesEncoder( uint8_t i2caddr );
@@ -73,6 +83,8 @@ public:
   uint8_t ringLight( int index, ledColorInfo_t ledColor );
   void ringLight( ledColorInfo_t ledColor );
   void ringLight( uint16_t *patternTable, uint16_t delayTime, ledColorInfo_t ledColor );
+  bool ringLightTask( unsigned long now );
+  bool ringLightBusy( void );
 
 };
 
@@ -0,0 +1,226 @@
+// glyphCache
+
+/*
+  glyphCache.cpp
+    GlyphCache renders the glyphs once by the font into 1 bit sprites, and pushes only the cells changed.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "glyphCache.h"
+
+// GlyphCache class constructor.
+GlyphCache::GlyphCache()
+{
+  font = 0;
+  top = 0;
+  height = 0;
+  bytes = 0;
+  blits = 0;
+  skips = 0;
+  for ( int i = 0; i < GLYPH_COUNT; i++ ) {
+    width[i] = 0;
+    sprite[i] = NULL;
+  }
+}
+
+// GlyphCache class destructor.
+GlyphCache::~GlyphCache()
+{
+  end();
+}
+
+int GlyphCache::glyphIndex( char c )
+{
+  const char *p = strchr( GLYPH_CHARS, c );
+  return ( c != '\0' && p != NULL ) ? p - GLYPH_CHARS : -1;
+}
+
+/*************************************************************************
+ * NAME  begin -
+ *
+ * SYNOPSIS
+ *
+ *    bool GlyphCache::begin( uint8_t font, size_t maxBytes )
+ *
+ * DESCRIPTION
+ *  Render the glyphs of the <font>. First each glyph is drawn in a
+ *  temporary 16 bit sprite to find the rows of the ink, then the rows are
+ *  drawn in a 1 bit sprite. A glyph which does not fit in the <maxBytes>
+ *  is not cached, and the string including it is drawn by the font.
+ *  Returns false if no glyph is cached.
+ *************************************************************************/
+bool GlyphCache::begin( uint8_t font, size_t maxBytes )
+{
+  end();
+  this->font = font;
+  int fontHeight = M5.Lcd.fontHeight( font );
+  char str[2] = { 0, 0 };
+
+  // Rows of the ink of all of the glyphs.
+  int inkTop = fontHeight;
+  int inkBottom = 0;
+  for ( int i = 0; i < GLYPH_COUNT; i++ ) {
+    str[0] = GLYPH_CHARS[i];
+    width[i] = M5.Lcd.textWidth( str, font );
+    if ( width[i] <= 0 ) continue;
+    TFT_eSprite work( &M5.Lcd );
+    work.setColorDepth( 16 );
+    uint16_t *pixel = (uint16_t *)work.createSprite( width[i], fontHeight );
+    if ( pixel == NULL ) continue;
+    work.fillSprite( TFT_BLACK );
+    work.setTextColor( TFT_WHITE );
+    work.drawString( str, 0, 0, font );
+    for ( int row = 0; row < fontHeight; row++ ) {
+      for ( int col = 0; col < width[i]; col++ ) {
+        if ( pixel[row * width[i] + col] != TFT_BLACK ) {
+          if ( row < inkTop ) inkTop = row;
+          if ( row >= inkBottom ) inkBottom = row + 1;
+          break;
+        }
+      }
+    }
+    work.deleteSprite();
+  }
+  if ( inkBottom <= inkTop ) return false;
+  top = inkTop;
+  height = inkBottom - inkTop;
+
+  // Glyphs of the ink rows.
+  for ( int i = 0; i < GLYPH_COUNT; i++ ) {
+    if ( width[i] <= 0 ) continue;
+    size_t size = ( ( width[i] + 7 ) / 8 ) * height;
+    if ( bytes + size > maxBytes ) continue;
+    sprite[i] = new TFT_eSprite( &M5.Lcd );
+    sprite[i]->setColorDepth( 1 );
+    if ( sprite[i]->createSprite( width[i], height ) == NULL ) {
+      delete sprite[i];
+      sprite[i] = NULL;
+      continue;
+    }
+    str[0] = GLYPH_CHARS[i];
+    sprite[i]->fillSprite( TFT_BLACK );
+    sprite[i]->setTextColor( TFT_WHITE );
+    sprite[i]->drawString( str, 0, -top, font );
+    bytes += size;
+  }
+  return bytes > 0;
+}
+
+// Delete all of the glyphs.
+void GlyphCache::end( void )
+{
+  for ( int i = 0; i < GLYPH_COUNT; i++ ) {
+    if ( sprite[i] != NULL ) {
+      sprite[i]->deleteSprite();
+      delete sprite[i];
+      sprite[i] = NULL;
+    }
+  }
+  bytes = 0;
+}
+
+// Returns the memory used by the glyphs.
+size_t GlyphCache::size( void )
+{
+  return bytes;
+}
+
+// Returns the width of the <str> drawn by the <font>.
+// Returns -1 if the <font> is not the font of the cache, or any character is not cached.
+int GlyphCache::textWidth( const char *str, uint8_t font )
+{
+  if ( font != this->font || bytes == 0 ) return -1;
+  int total = 0;
+  int n = 0;
+  for ( const char *p = str; *p; p++ ) {
+    int i = glyphIndex( *p );
+    if ( i < 0 || sprite[i] == NULL || ++n > GLYPH_MAXCELLS ) return -1;
+    total += width[i];
+  }
+  return total;
+}
+
+// Returns true if the ink rows of the string drawn at the <y> are in the rows from <clipTop> to <clipBottom> - 1.
+bool GlyphCache::fits( int y, int clipTop, int clipBottom )
+{
+  return ( y + top >= clipTop ) && ( y + top + height <= clipBottom );
+}
+
+/*************************************************************************
+ * NAME  drawString -
+ *
+ * SYNOPSIS
+ *
+ *    void GlyphCache::drawString( const char *str, int x, int y, uint16_t fgColor, uint16_t bgColor, glyphLine_t *line )
+ *
+ * DESCRIPTION
+ *  Draw the <str> from the <x> as the cells of the glyphs. The <y> is the
+ *  top of the font height, same as M5.Lcd.drawString().
+ *  A cell of the same character at the same position as the <line> is
+ *  skipped, and the part of the last string out of the new one is filled
+ *  with the <bgColor>. The caller checks the <str> by textWidth() and fits().
+ *************************************************************************/
+void GlyphCache::drawString( const char *str, int x, int y, uint16_t fgColor, uint16_t bgColor, glyphLine_t *line )
+{
+  int rowTop = y + top;
+
+  // The string moved up or down, so nothing can be kept.
+  if ( line->count >= 0 && line->y != y ) {
+    M5.Lcd.fillRect( line->left, line->y + top, line->right - line->left, height, bgColor );
+    line->count = GLYPH_FILLED;
+  }
+  bool keep = ( line->count >= 0 && line->fgColor == fgColor && line->bgColor == bgColor );
+
+  glyphLine_t next;
+  next.count = 0;
+  next.fgColor = fgColor;
+  next.bgColor = bgColor;
+  next.y = y;
+  next.left = x;
+
+  int old = 0;
+  for ( const char *p = str; *p; p++ ) {
+    int i = glyphIndex( *p );
+    while ( keep && old < line->count && line->x[old] < x ) old++;
+    if ( keep && old < line->count && line->x[old] == x && line->ch[old] == *p ) {
+      skips++;
+    } else {
+      sprite[i]->setBitmapColor( fgColor, bgColor );
+      sprite[i]->pushSprite( x, rowTop );
+      blits++;
+    }
+    next.x[next.count] = x;
+    next.ch[next.count] = *p;
+    next.count++;
+    x += width[i];
+  }
+  next.right = x;
+
+  // Fill the part of the last string out of the new one.
+  if ( line->count >= 0 ) {
+    if ( next.count == 0 ) {
+      M5.Lcd.fillRect( line->left, rowTop, line->right - line->left, height, bgColor );
+    } else {
+      if ( line->left < next.left ) {
+        int right = ( line->right < next.left ) ? line->right : next.left;
+        M5.Lcd.fillRect( line->left, rowTop, right - line->left, height, bgColor );
+      }
+      if ( line->right > next.right ) {
+        int left = ( line->left > next.right ) ? line->left : next.right;
+        M5.Lcd.fillRect( left, rowTop, line->right - left, height, bgColor );
+      }
+    }
+  }
+  *line = next;
+}
+
+// Set the <line> to GLYPH_FILLED or GLYPH_DIRTY.
+void GlyphCache::invalidate( glyphLine_t *line, int8_t state )
+{
+  line->count = state;
+}
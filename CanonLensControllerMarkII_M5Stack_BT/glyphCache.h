@@ -0,0 +1,77 @@
+// glyphCache
+
+/*
+  glyphCache.h
+    Pre-rendered glyphs of the large numerals (the digits, '.' and '-') of one font.
+    The glyphs are kept in 1 bit sprites and are coloured when they are pushed, so one set of
+    glyphs is used for all of the colour pairs. Only the rows that have ink in any glyph are kept.
+    A string is drawn as the cells of the glyphs, and only the cells changed from the last
+    drawing are pushed to the LCD.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  begin()       Render the glyphs of the font within the memory limit.
+  textWidth()   Width of the string, or -1 if any character is not in the cache.
+  fits()        Check the rows of the glyphs are in the clip rows.
+  drawString()  Draw the string as the cells, skipping the cells not changed.
+*/
+
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+#include <M5Stack.h>
+
+#define GLYPH_CHARS     "0123456789.-"
+#define GLYPH_COUNT     12
+#define GLYPH_MAXBYTES  4096  // default memory limit of the glyph sprites
+#define GLYPH_MAXCELLS  12    // max length of the string drawn by the cells
+
+#define GLYPH_FILLED    -1    // The area has only the fill colour, no cell is drawn.
+#define GLYPH_DIRTY     -2    // The area was drawn by the others, and must be filled first.
+
+// The cells drawn last time. One for each label.
+typedef struct {
+  int8_t count;           // number of cells, or GLYPH_FILLED / GLYPH_DIRTY
+  uint16_t fgColor;
+  uint16_t bgColor;
+  int16_t y;
+  int16_t left;           // x range of the cells
+  int16_t right;
+  int16_t x[GLYPH_MAXCELLS];
+  char ch[GLYPH_MAXCELLS];
+} glyphLine_t;
+
+class GlyphCache
+{
+private:
+  uint8_t font;
+  int16_t top;            // first row of the ink in the font height
+  int16_t height;         // rows of the ink
+  size_t bytes;
+  int16_t width[GLYPH_COUNT];
+  TFT_eSprite *sprite[GLYPH_COUNT];
+
+  int glyphIndex( char c );
+
+public:
+  GlyphCache();
+  ~GlyphCache();
+
+  unsigned long blits;    // Cells pushed to the LCD.
+  unsigned long skips;    // Cells not changed.
+
+  bool begin( uint8_t font, size_t maxBytes );
+  void end( void );
+  size_t size( void );
+  int textWidth( const char *str, uint8_t font );
+  bool fits( int y, int clipTop, int clipBottom );
+  void drawString( const char *str, int x, int y, uint16_t fgColor, uint16_t bgColor, glyphLine_t *line );
+  static void invalidate( glyphLine_t *line, int8_t state );
+};
+
+#endif  /* GLYPHCACHE_H */
@@ -0,0 +1,179 @@
+// keyEngine
+
+/*
+  keyEngine.cpp
+    KeyEngine runs the state of each key from the key mask, and queues the events for dispatch().
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "keyEngine.h"
+
+// KeyEngine class constructor.
+KeyEngine::KeyEngine()
+{
+  setTiming( KEY_LONGPRESSMS, KEY_REPEATDELAYMS, KEY_REPEATSLOWMS, KEY_REPEATFASTMS );
+  longHandled = 0;
+  clear();
+}
+
+// KeyEngine class destructor.
+KeyEngine::~KeyEngine()
+{
+}
+
+// Set the long-press time, the delay until the first auto-repeat and the range of the auto-repeat interval.
+void KeyEngine::setTiming( uint16_t longPress, uint16_t repeatDelay, uint16_t repeatSlow, uint16_t repeatFast )
+{
+  longPressMs = longPress;
+  repeatDelayMs = repeatDelay;
+  repeatSlowMs = repeatSlow;
+  repeatFastMs = ( repeatFast < repeatSlow ) ? repeatFast : repeatSlow;
+}
+
+// Forget the key state and the queued events.
+void KeyEngine::clear( void )
+{
+  for ( int k = 0; k < KEY_COUNT; k++ ) {
+    keys[k].pressed = false;
+    keys[k].longFired = false;
+    keys[k].chorded = false;
+    keys[k].modifier = KEY_NONE;
+    keys[k].repeatCount = 0;
+  }
+  front = 0;
+  count = 0;
+}
+
+// The auto-repeat gets faster every time it repeats.
+uint16_t KeyEngine::repeatInterval( uint16_t repeatCount )
+{
+  uint32_t decrease = (uint32_t)repeatCount * KEY_REPEATSTEPMS;
+  if ( decrease >= (uint32_t)( repeatSlowMs - repeatFastMs ) ) return repeatFastMs;
+  return repeatSlowMs - decrease;
+}
+
+// Queue one event. The oldest event is dropped out when the queue is full.
+void KeyEngine::queue( uint8_t key, uint8_t modifier, uint8_t event, uint16_t repeatCount )
+{
+  if ( count >= KEY_EVENTQUEUE ) {
+    front = ( front + 1 ) % KEY_EVENTQUEUE;
+    count--;
+  }
+  keyEvent_t *ev = &events[( front + count ) % KEY_EVENTQUEUE];
+  ev->key = key;
+  ev->modifier = modifier;
+  ev->event = event;
+  ev->repeatCount = repeatCount;
+  if ( event != KEY_EVENT_REPEAT || repeatCount < KEY_ACCELSTAGE1 ) {
+    ev->magnitude = 1;
+  } else if ( repeatCount < KEY_ACCELSTAGE2 ) {
+    ev->magnitude = 10;
+  } else {
+    ev->magnitude = 100;
+  }
+  count++;
+}
+
+// Give the key mask (KEYBIT_*) of the keys currently held down.
+// The time is compared by the difference, so the wrap around of millis() is harmless.
+void KeyEngine::update( uint8_t keyMask, unsigned long now )
+{
+  for ( int k = 0; k < KEY_COUNT; k++ ) {
+    keyState_t *ks = &keys[k];
+    bool down = ( keyMask & ( 1 << k ) ) ? true : false;
+
+    if ( down && !ks->pressed ) {
+      // A key held down already makes this key a chord.
+      uint8_t modifier = KEY_NONE;
+      for ( int m = 0; m < KEY_COUNT; m++ ) {
+        if ( m != k && keys[m].pressed ) {
+          modifier = m;
+          keys[m].chorded = true;
+          break;
+        }
+      }
+      ks->pressed = true;
+      ks->longFired = false;
+      ks->chorded = false;
+      ks->modifier = modifier;
+      ks->repeatCount = 0;
+      ks->pressTime = now;
+      ks->repeatTime = now + repeatDelayMs;
+      queue( k, modifier, KEY_EVENT_PRESS, 0 );
+    } else if ( !down && ks->pressed ) {
+      ks->pressed = false;
+      if ( !ks->chorded ) {
+        queue( k, ks->modifier, ks->longFired ? KEY_EVENT_LONGCLICK : KEY_EVENT_CLICK, 0 );
+      }
+    } else if ( down && !ks->chorded ) {
+      if ( !ks->longFired && (long)( now - ks->pressTime ) >= (long)longPressMs ) {
+        ks->longFired = true;
+        queue( k, ks->modifier, KEY_EVENT_LONGPRESS, 0 );
+      }
+      if ( (long)( now - ks->repeatTime ) >= 0 ) {
+        ks->repeatCount++;
+        queue( k, ks->modifier, KEY_EVENT_REPEAT, ks->repeatCount );
+        ks->repeatTime += repeatInterval( ks->repeatCount );
+        if ( (long)( now - ks->repeatTime ) >= 0 ) {
+          ks->repeatTime = now + repeatInterval( ks->repeatCount );   // Don't burst when the loop was late.
+        }
+      }
+    }
+  }
+}
+
+// Queue a press and a click of one key at once.
+void KeyEngine::inject( uint8_t key, uint8_t modifier )
+{
+  if ( key >= KEY_COUNT ) return;
+  queue( key, modifier, KEY_EVENT_PRESS, 0 );
+  queue( key, modifier, KEY_EVENT_CLICK, 0 );
+}
+
+// Returns the number of queued events.
+int KeyEngine::available( void )
+{
+  return count;
+}
+
+// Take out the oldest event.
+bool KeyEngine::pop( keyEvent_t *event )
+{
+  if ( count <= 0 ) return false;
+  *event = events[front];
+  front = ( front + 1 ) % KEY_EVENTQUEUE;
+  count--;
+  return true;
+}
+
+// Call the handler bound to the <event> for the <phase>.
+// Returns false if there is no binding.
+// When the long-press was handled, the long-click of the same press is not dispatched,
+// because the handler may have changed the phase and the release would run the binding of the new phase.
+// This is decided here by the events, not in update(), so the recorded events in the replay behave the same.
+bool KeyEngine::dispatch( int phase, const keyBinding_t *table, int tableSize, const keyEvent_t *event )
+{
+  uint8_t keyBit = ( event->key < KEY_COUNT ) ? ( 1 << event->key ) : 0;
+  if ( event->event == KEY_EVENT_PRESS ) {
+    longHandled &= ~keyBit;
+  } else if ( event->event == KEY_EVENT_LONGCLICK && ( longHandled & keyBit ) ) {
+    longHandled &= ~keyBit;
+    return false;
+  }
+  for ( int i = 0; i < tableSize; i++ ) {
+    const keyBinding_t *bind = &table[i];
+    if ( bind->phase == phase && bind->key == event->key && bind->modifier == event->modifier && ( bind->eventMask & event->event ) ) {
+      if ( event->event == KEY_EVENT_LONGPRESS ) {
+        longHandled |= keyBit;
+      }
+      bind->handler( event );
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,108 @@
+// keyEngine
+
+/*
+  keyEngine.h
+    This module turns the raw state of the M5Stack buttons (local or remote) into key events.
+    Press, click, long-press, long-click, accelerating auto-repeat and chord events are generated
+    and dispatched through a binding table for each phase of the state machine.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  update()    Give the current key mask, and the engine queues the events.
+  inject()    Queue a single press and click (for the legacy "B" message of the remote).
+  pop()       Take out the queued event.
+  dispatch()  Call the handler bound to the event for the phase.
+              The long-click after a long-press handled is not dispatched.
+*/
+
+#ifndef KEYENGINE_H
+#define KEYENGINE_H
+
+#include <Arduino.h>
+
+#define KEY_A     0   // M5Stack A button
+#define KEY_B     1   // M5Stack B button
+#define KEY_C     2   // M5Stack C button
+#define KEY_COUNT 3
+#define KEY_NONE  0xFF
+
+#define KEYBIT_A  ( 1 << KEY_A )
+#define KEYBIT_B  ( 1 << KEY_B )
+#define KEYBIT_C  ( 1 << KEY_C )
+
+#define KEY_EVENT_PRESS     0x01  // The key went down.
+#define KEY_EVENT_CLICK     0x02  // The key was released before the long-press time.
+#define KEY_EVENT_LONGPRESS 0x04  // The key was held down for the long-press time.
+#define KEY_EVENT_REPEAT    0x08  // Auto-repeat while the key is held down.
+#define KEY_EVENT_LONGCLICK 0x10  // The key was released after the long-press time, no chord was made and the long-press was not handled.
+
+#define KEY_LONGPRESSMS     800   // Time until the long-press event.
+#define KEY_REPEATDELAYMS   400   // Time until the first auto-repeat.
+#define KEY_REPEATSLOWMS    150   // First auto-repeat interval.
+#define KEY_REPEATFASTMS    40    // Shortest auto-repeat interval.
+#define KEY_REPEATSTEPMS    10    // Decrease of the interval for each auto-repeat.
+#define KEY_ACCELSTAGE1     10    // Number of repeats until the magnitude becomes 10.
+#define KEY_ACCELSTAGE2     25    // Number of repeats until the magnitude becomes 100.
+#define KEY_EVENTQUEUE      16    // Number of events that can be queued.
+
+typedef struct {
+  uint8_t key;
+  uint8_t modifier;       // The key already held down when <key> was pressed (chord), or KEY_NONE.
+  uint8_t event;
+  uint16_t repeatCount;
+  int16_t magnitude;      // Step multiplier of the accelerating auto-repeat (1, 10, 100).
+} keyEvent_t;
+
+typedef struct {
+  int phase;
+  uint8_t key;
+  uint8_t modifier;       // KEY_NONE matches only the key pressed alone.
+  uint8_t eventMask;
+  void (*handler)( const keyEvent_t *event );
+} keyBinding_t;
+
+class KeyEngine
+{
+private:
+  typedef struct {
+    bool pressed;
+    bool longFired;
+    bool chorded;         // Another key was pressed while this key was held down.
+    uint8_t modifier;
+    uint16_t repeatCount;
+    unsigned long pressTime;
+    unsigned long repeatTime;
+  } keyState_t;
+
+  keyState_t keys[KEY_COUNT];
+  keyEvent_t events[KEY_EVENTQUEUE];
+  int front;
+  int count;
+  uint8_t longHandled;    // KEYBIT_* of the keys whose long-press was handled by dispatch().
+  uint16_t longPressMs;
+  uint16_t repeatDelayMs;
+  uint16_t repeatSlowMs;
+  uint16_t repeatFastMs;
+
+  void queue( uint8_t key, uint8_t modifier, uint8_t event, uint16_t repeatCount );
+  uint16_t repeatInterval( uint16_t repeatCount );
+
+public:
+  KeyEngine();
+  ~KeyEngine();
+
+  void setTiming( uint16_t longPress, uint16_t repeatDelay, uint16_t repeatSlow, uint16_t repeatFast );
+  void update( uint8_t keyMask, unsigned long now );
+  void inject( uint8_t key, uint8_t modifier );
+  void clear( void );
+  int available( void );
+  bool pop( keyEvent_t *event );
+  bool dispatch( int phase, const keyBinding_t *table, int tableSize, const keyEvent_t *event );
+};
+
+#endif  /* KEYENGINE_H */
@@ -0,0 +1,369 @@
+// lensLibrary
+
+/*
+  lensLibrary.cpp
+    LensLibrary indexes the lines of the lens file by the pages, and reads the window of the lenses on demand.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "lensLibrary.h"
+
+// LensLibrary class constructor.
+LensLibrary::LensLibrary()
+{
+  fsp = NULL;
+  filepath = NULL;
+  numberOfLens = 0;
+  pageSize = LENS_WINDOW;
+  windowStart = 0;
+  windowCount = 0;
+  emptyLens.numberOfAperture = 0;
+  emptyLens.focalLength = 0;
+  for ( int i = 0; i < LENS_RECENT; i++ ) {
+    recentList[i] = -1;
+  }
+}
+
+// LensLibrary class destructor.
+LensLibrary::~LensLibrary()
+{
+}
+
+// Read one line. Returns false at the end of the file.
+bool LensLibrary::readLine( File &file, char *buff )
+{
+  char *p = buff;
+  bool valid = false;
+  while ( file.available() ) {
+    uint8_t data = file.read();
+    valid = true;
+    if ( data == 0x0d ) continue;
+    if ( data == 0x0a ) break;
+    if ( p < &buff[LENS_LINEMAX - 1] ) {
+      *p++ = data;
+    }
+  }
+  *p = '\0';
+  return valid;
+}
+
+// Read the next "lensN=<name> | <aperture list>" line.
+// Comment lines beginning with '#' and the other keys are skipped.
+bool LensLibrary::readEntry( File &file, lensInfo_t *lens )
+{
+  char buff[LENS_LINEMAX];
+  while ( readLine( file, buff ) ) {
+    char *p = buff;
+    while ( *p == ' ' || *p == '\t' ) p++;
+    if ( strncmp( p, "lens", 4 ) != 0 ) continue;
+    p += 4;
+    if ( !isdigit( *p ) ) continue;
+    while ( isdigit( *p ) ) p++;
+    if ( *p++ != '=' ) continue;
+    char *s1 = strchr( p, '|' );  // Find the separator between the lens name and the aperture string.
+    if ( s1 == NULL || s1 == p ) continue;
+    *s1++ = '\0';
+
+    // Every aperture must be a number. ("1.8", "22") The line is skipped if any is malformed.
+    Tokenizer tokens( s1, ' ' );
+    int numberOfAperture = 0;
+    int fnumber;
+    while ( tokens.nextFixed( &fnumber, 1 ) ) numberOfAperture++;
+    if ( numberOfAperture == 0 || !tokens.atEnd() ) continue;
+
+    lens->lensName = String( p );
+    lens->lensName.trim();
+    lens->apertureLine = String( s1 );
+    lens->apertureLine.trim();
+    lens->focalLength = focalLength( p );
+    lens->numberOfAperture = numberOfAperture;
+    return true;
+  }
+  return false;
+}
+
+// Scan the lens information file, and make the page index.
+// When the index is full, every two pages are merged and the page size is doubled,
+// so the memory used does not grow with the number of lenses.
+bool LensLibrary::open( fs::FS &fs, const char *path )
+{
+  fsp = &fs;
+  filepath = path;
+  numberOfLens = 0;
+  pageSize = LENS_WINDOW;
+  windowStart = 0;
+  windowCount = 0;
+
+  File file = fs.open( path, FILE_READ );
+  if ( !file ) return false;
+
+  lensInfo_t lens;
+  uint32_t offset = file.position();
+  while ( readEntry( file, &lens ) ) {
+    if ( numberOfLens == pageSize * LENS_MAXPAGES ) {
+      for ( int i = 0; i < LENS_MAXPAGES / 2; i++ ) {
+        lensPage_t *first = &pageIndex[i * 2];
+        lensPage_t *second = &pageIndex[i * 2 + 1];
+        pageIndex[i].offset = first->offset;
+        pageIndex[i].initials = first->initials | second->initials;
+        pageIndex[i].minFocal = ( first->minFocal == 0 || ( second->minFocal != 0 && second->minFocal < first->minFocal ) ) ? second->minFocal : first->minFocal;
+        pageIndex[i].maxFocal = ( second->maxFocal > first->maxFocal ) ? second->maxFocal : first->maxFocal;
+      }
+      pageSize *= 2;
+    }
+    lensPage_t *summary = &pageIndex[numberOfLens / pageSize];
+    if ( ( numberOfLens % pageSize ) == 0 ) {
+      summary->offset = offset;
+      summary->minFocal = 0;
+      summary->maxFocal = 0;
+      summary->initials = 0;
+    }
+    addToPage( summary, &lens );
+    if ( numberOfLens < LENS_WINDOW ) {
+      window[numberOfLens] = lens;
+      windowCount++;
+    }
+    numberOfLens++;
+    offset = file.position();
+  }
+  file.close();
+  return numberOfLens > 0;
+}
+
+// Add the lens to the summary of the page.
+void LensLibrary::addToPage( lensPage_t *summary, const lensInfo_t *lens )
+{
+  summary->initials |= initialBit( lens->lensName.c_str()[0] );
+  int focal = ( lens->focalLength > 0xFFFF ) ? 0xFFFF : lens->focalLength;
+  if ( focal <= 0 ) return;
+  if ( summary->minFocal == 0 || focal < summary->minFocal ) summary->minFocal = focal;
+  if ( focal > summary->maxFocal ) summary->maxFocal = focal;
+}
+
+// The bit of the first letter of the name, ignoring case.
+uint32_t LensLibrary::initialBit( char c )
+{
+  if ( isalpha( c ) ) return 1UL << ( tolower( c ) - 'a' );
+  if ( isdigit( c ) ) return 1UL << LENS_INITIALDIGIT;
+  return 1UL << LENS_INITIALOTHER;
+}
+
+// Returns the number of lenses.
+int LensLibrary::count( void )
+{
+  return numberOfLens;
+}
+
+int LensLibrary::numberOfPages( void )
+{
+  return ( numberOfLens + pageSize - 1 ) / pageSize;
+}
+
+// Read the window including the <index> from the SD card.
+bool LensLibrary::loadWindow( int index )
+{
+  int start = index - ( index % LENS_WINDOW );
+  int page = start / pageSize;
+
+  windowStart = start;
+  windowCount = 0;
+  File file = fsp->open( filepath, FILE_READ );
+  if ( !file ) return false;
+  file.seek( pageIndex[page].offset );
+
+  lensInfo_t lens;
+  for ( int n = page * pageSize; n < start; n++ ) {
+    if ( !readEntry( file, &lens ) ) break;
+  }
+  while ( windowCount < LENS_WINDOW && readEntry( file, &window[windowCount] ) ) {
+    windowCount++;
+  }
+  file.close();
+  return windowCount > 0;
+}
+
+// Returns the lens of the <index>.
+// The returned pointer is valid until get() of the index in the other window.
+lensInfo_t *LensLibrary::get( int index )
+{
+  if ( index < 0 || index >= numberOfLens ) return &emptyLens;
+  if ( index < windowStart || index >= windowStart + windowCount ) {
+    if ( !loadWindow( index ) ) return &emptyLens;
+  }
+  if ( index - windowStart >= windowCount ) return &emptyLens;
+  return &window[index - windowStart];
+}
+
+// Returns the aperture string of the <index> of the lens.
+String LensLibrary::aperture( const lensInfo_t *lens, int index )
+{
+  Tokenizer tokens( lens->apertureLine.c_str(), ' ' );
+  tokenView_t token;
+  for ( int n = 0; tokens.next( &token ); n++ ) {
+    if ( n == index ) return Tokenizer::toString( &token );
+  }
+  return String();
+}
+
+// Search the lens name which starts with the <prefix>, ignoring case.
+// The search begins next to the <from> and goes round. Returns -1 if not found.
+// Only the pages having the first letter of the <prefix> are read.
+int LensLibrary::findPrefix( const char *prefix, int from )
+{
+  int found = -1;
+  int foundAfter = -1;
+  int len = strlen( prefix );
+  uint32_t initial = initialBit( prefix[0] );
+  File file = fsp->open( filepath, FILE_READ );
+  if ( !file ) return -1;
+
+  lensInfo_t lens;
+  for ( int p = 0; p < numberOfPages() && foundAfter < 0; p++ ) {
+    if ( len > 0 && ( pageIndex[p].initials & initial ) == 0 ) continue;
+    file.seek( pageIndex[p].offset );
+    for ( int n = p * pageSize; n < ( p + 1 ) * pageSize && readEntry( file, &lens ); n++ ) {
+      if ( strncasecmp( lens.lensName.c_str(), prefix, len ) == 0 ) {
+        if ( found < 0 ) found = n;
+        if ( n > from ) {
+          foundAfter = n;
+          break;
+        }
+      }
+    }
+  }
+  file.close();
+  return ( foundAfter >= 0 ) ? foundAfter : found;
+}
+
+// Search the lens of the nearest focal length. Returns -1 if no lens has the focal length.
+// The page whose range of the focal lengths is not nearer than the one found is not read.
+int LensLibrary::findFocalLength( int focalLength )
+{
+  int found = -1;
+  int nearest = 0;
+  File file = fsp->open( filepath, FILE_READ );
+  if ( !file ) return -1;
+
+  lensInfo_t lens;
+  for ( int p = 0; p < numberOfPages(); p++ ) {
+    if ( pageIndex[p].minFocal == 0 ) continue;
+    int bound = ( focalLength < pageIndex[p].minFocal ) ? pageIndex[p].minFocal - focalLength
+              : ( focalLength > pageIndex[p].maxFocal ) ? focalLength - pageIndex[p].maxFocal : 0;
+    if ( found >= 0 && bound >= nearest ) continue;
+    file.seek( pageIndex[p].offset );
+    for ( int n = p * pageSize; n < ( p + 1 ) * pageSize && readEntry( file, &lens ); n++ ) {
+      if ( lens.focalLength <= 0 ) continue;
+      int diff = abs( lens.focalLength - focalLength );
+      if ( found < 0 || diff < nearest ) {
+        found = n;
+        nearest = diff;
+      }
+    }
+  }
+  file.close();
+  return found;
+}
+
+// Search the first lens of the next longer focal length than the lens of the <index>.
+// After the longest one, returns the shortest one.
+// Only the pages which can have a nearer longer one or a shorter shortest one are read.
+int LensLibrary::nextFocalLength( int index )
+{
+  int current = get( index )->focalLength;
+  int next = -1, nextFocal = 0;
+  int shortest = -1, shortestFocal = 0;
+  File file = fsp->open( filepath, FILE_READ );
+  if ( !file ) return -1;
+
+  lensInfo_t lens;
+  for ( int p = 0; p < numberOfPages(); p++ ) {
+    if ( pageIndex[p].minFocal == 0 ) continue;
+    bool nextInPage = pageIndex[p].maxFocal > current && ( next < 0 || pageIndex[p].minFocal < nextFocal );
+    bool shortestInPage = shortest < 0 || pageIndex[p].minFocal < shortestFocal;
+    if ( !nextInPage && !shortestInPage ) continue;
+    file.seek( pageIndex[p].offset );
+    for ( int n = p * pageSize; n < ( p + 1 ) * pageSize && readEntry( file, &lens ); n++ ) {
+      int focal = lens.focalLength;
+      if ( focal <= 0 ) continue;
+      if ( focal > current && ( next < 0 || focal < nextFocal ) ) {
+        next = n;
+        nextFocal = focal;
+      }
+      if ( shortest < 0 || focal < shortestFocal ) {
+        shortest = n;
+        shortestFocal = focal;
+      }
+    }
+  }
+  file.close();
+  return ( next >= 0 ) ? next : shortest;
+}
+
+// Move the lens of the <index> to the top of the most recently used list.
+void LensLibrary::touch( int index )
+{
+  int n;
+  for ( n = 0; n < LENS_RECENT - 1; n++ ) {
+    if ( recentList[n] == index ) break;
+  }
+  for ( ; n > 0; n-- ) {
+    recentList[n] = recentList[n - 1];
+  }
+  recentList[0] = index;
+}
+
+// Returns the <n>th most recently used lens, or -1.
+int LensLibrary::recent( int n )
+{
+  if ( n < 0 || n >= LENS_RECENT ) return -1;
+  if ( recentList[n] >= numberOfLens ) return -1;
+  return recentList[n];
+}
+
+// The most recently used list separated by spaces, for the INI file.
+String LensLibrary::recentString( void )
+{
+  String recentStr;
+  for ( int n = 0; n < LENS_RECENT; n++ ) {
+    if ( recentList[n] < 0 ) break;
+    if ( n > 0 ) recentStr += ' ';
+    recentStr += String( recentList[n] );
+  }
+  return recentStr;
+}
+
+void LensLibrary::setRecentString( String recentStr )
+{
+  const char *p = recentStr.c_str();
+  for ( int n = 0; n < LENS_RECENT; n++ ) {
+    char *e;
+    long index = strtol( p, &e, 10 );
+    recentList[n] = ( e != p && index >= 0 ) ? (int)index : -1;
+    p = e;
+  }
+}
+
+// Take the focal length from the lens name. "Sigma 15mm F2.4" -> 15, "EF 24-70mm f/2.8L" -> 24, "EF 50 mm" -> 50
+// Returns 0 if the lens name has no focal length.
+int LensLibrary::focalLength( const char *lensName )
+{
+  for ( const char *p = lensName; *p; p++ ) {
+    if ( !isdigit( *p ) ) continue;
+    if ( p > lensName && ( isdigit( p[-1] ) || p[-1] == '.' || p[-1] == '/' ) ) continue;
+    int focal = 0;
+    const char *q = p;
+    while ( isdigit( *q ) ) focal = focal * 10 + ( *q++ - '0' );
+    if ( *q == '-' ) {
+      q++;
+      while ( isdigit( *q ) ) q++;
+    }
+    if ( *q == ' ' ) q++;
+    if ( tolower( q[0] ) == 'm' && tolower( q[1] ) == 'm' ) return focal;
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+// lensLibrary
+
+/*
+  lensLibrary.h
+    The lens information list on the micro SD card.
+    Any number of "lensN=<name> | <aperture list>" lines can be written in the file.
+    Only a small window of the list is kept in memory and is read again from the SD card as needed.
+    Each page of the index has the range of the focal lengths and the first letters of the names,
+    so the searches read only the pages which can have the lens.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  open()              Scan the file once and make the page index. (file offset and summary of every <pageSize> lenses)
+  get()               Returns the lens of the index. The window is read again when the index is out of it.
+  findPrefix()        Search the lens name which starts with the prefix.
+  findFocalLength()   Search the lens of the nearest focal length.
+  nextFocalLength()   Search the lens of the next longer focal length.
+  touch()/recent()    The most recently used lenses.
+*/
+
+#ifndef LENSLIBRARY_H
+#define LENSLIBRARY_H
+
+#include <M5Stack.h>
+#include "tokenizer.h"
+
+#define LENS_WINDOW     8     // number of lenses kept in memory
+#define LENS_MAXPAGES   64    // number of entries of the page index
+#define LENS_RECENT     4     // number of the most recently used lenses
+#define LENS_LINEMAX    256   // max length of one line
+#define LENS_INITIALDIGIT 26  // bit of the names beginning with a digit in lensPage_t.initials
+#define LENS_INITIALOTHER 27  // bit of the names beginning with the others
+
+typedef struct {
+  String lensName;
+  String apertureLine;    // Aperture list separated by spaces.
+  int numberOfAperture;
+  int focalLength;        // Focal length in mm taken from the lens name. (the shortest one of a zoom lens)
+} lensInfo_t;
+
+// Summary of the lenses of one page of the index.
+typedef struct {
+  uint32_t offset;        // File offset of the first lens.
+  uint16_t minFocal;      // Range of the focal lengths, 0 if no lens has it.
+  uint16_t maxFocal;
+  uint32_t initials;      // Bits of the first letters of the names. (a to z, LENS_INITIALDIGIT, LENS_INITIALOTHER)
+} lensPage_t;
+
+class LensLibrary
+{
+private:
+  fs::FS *fsp;
+  const char *filepath;
+  int numberOfLens;
+  int pageSize;
+  lensPage_t pageIndex[LENS_MAXPAGES];
+  int windowStart;
+  int windowCount;
+  lensInfo_t window[LENS_WINDOW];
+  lensInfo_t emptyLens;
+  int recentList[LENS_RECENT];
+
+  bool readLine( File &file, char *buff );
+  bool readEntry( File &file, lensInfo_t *lens );
+  bool loadWindow( int index );
+  int numberOfPages( void );
+  void addToPage( lensPage_t *summary, const lensInfo_t *lens );
+  static uint32_t initialBit( char c );
+
+public:
+  LensLibrary();
+  ~LensLibrary();
+
+  bool open( fs::FS &fs, const char *path );
+  int count( void );
+  lensInfo_t *get( int index );
+  String aperture( const lensInfo_t *lens, int index );
+  int findPrefix( const char *prefix, int from );
+  int findFocalLength( int focalLength );
+  int nextFocalLength( int index );
+  void touch( int index );
+  int recent( int n );
+  String recentString( void );
+  void setRecentString( String recentStr );
+  static int focalLength( const char *lensName );
+};
+
+#endif  /* LENSLIBRARY_H */
@@ -0,0 +1,320 @@
+// lensMotion
+
+/*
+  lensMotion.cpp
+    LensMotion fits the offset and the speed of the moves by the running sums of the least squares.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "lensMotion.h"
+#include "tokenizer.h"
+
+// LensMotion class constructor.
+LensMotion::LensMotion()
+{
+  lensIndex = -1;
+  n = sumD = sumT = sumDD = sumDT = 0;
+  offsetMs = 0;
+  msPerStep = 0;
+  dirty = false;
+  moving = false;
+  restKnown = false;
+  clean = false;
+  restPosition = 0;
+  target = 0;
+  distance = 0;
+  lastProbePosition = 0;
+  probes = 0;
+  sameProbes = 0;
+  changeUs = 0;
+  moveUs = 0;
+  probeUs = 0;
+  movingProbeUs = 0;
+  predictedMs = 0;
+  memset( &stat, 0, sizeof( stat ) );
+}
+
+// LensMotion class destructor.
+LensMotion::~LensMotion()
+{
+}
+
+// Set the lens and the model saved by toString(). The malformed one is not learned yet.
+void LensMotion::setLens( int lensIndex, String saved )
+{
+  int samples, offset, speed, mean, sd;
+
+  this->lensIndex = lensIndex;
+  n = sumD = sumT = sumDD = sumDT = 0;
+  offsetMs = 0;
+  msPerStep = 0;
+  dirty = false;
+  Tokenizer tokens( saved.c_str(), ' ' );
+  if ( !tokens.nextInt( &samples ) || !tokens.nextInt( &offset ) || !tokens.nextInt( &speed )
+       || !tokens.nextInt( &mean ) || !tokens.nextInt( &sd ) ) return;
+  if ( samples <= 0 || offset < 0 || speed <= 0 || mean < 0 || sd < 0 ) return;
+
+  // The sums of the least squares which give the same model.
+  offsetMs = offset;
+  msPerStep = 1000.0 / speed;
+  n = ( samples < MOTION_MAXSAMPLES ) ? samples : MOTION_MAXSAMPLES;
+  sumD = n * mean;
+  sumDD = n * ( (double)sd * sd + (double)mean * mean );
+  sumT = n * ( offsetMs + msPerStep * mean );
+  sumDT = offsetMs * sumD + msPerStep * sumDD;
+}
+
+int LensMotion::lens( void )
+{
+  return lensIndex;
+}
+
+// The model to be saved. "<samples> <offset ms> <speed steps/s> <mean distance> <sd distance>"
+String LensMotion::toString( void )
+{
+  char buff[64];
+
+  double mean = ( n > 0 ) ? sumD / n : 0;
+  double var = ( n > 0 ) ? sumDD / n - mean * mean : 0;
+  snprintf( buff, sizeof( buff ), "%d %d %d %d %d", samples(), offset(), speed(), (int)( mean + 0.5 ), (int)( sqrt( ( var > 0 ) ? var : 0 ) + 0.5 ) );
+  return String( buff );
+}
+
+// Returns true if the model is changed from the saved one.
+bool LensMotion::isDirty( void )
+{
+  return dirty;
+}
+
+void LensMotion::saved( void )
+{
+  dirty = false;
+}
+
+bool LensMotion::isTrained( void )
+{
+  return n >= MOTION_MINSAMPLES && msPerStep > 0;
+}
+
+int LensMotion::samples( void )
+{
+  return (int)( n + 0.5 );
+}
+
+int LensMotion::offset( void )
+{
+  return (int)( offsetMs + 0.5 );
+}
+
+// Speed of the focus. (steps per second)
+int LensMotion::speed( void )
+{
+  return ( msPerStep > 0 ) ? (int)( 1000.0 / msPerStep + 0.5 ) : 0;
+}
+
+// Time of the move of the <distance>. (ms, rounded up)
+unsigned long LensMotion::predictMs( int distance )
+{
+  return (unsigned long)ceil( offsetMs + msPerStep * abs( distance ) );
+}
+
+bool LensMotion::isMoving( void )
+{
+  return moving;
+}
+
+/*************************************************************************
+ * NAME  moved -
+ *
+ * SYNOPSIS
+ *
+ *    unsigned long LensMotion::moved( int target, unsigned long nowUs )
+ *
+ * DESCRIPTION
+ *  The move to the <target> is sent at the <nowUs>.
+ *  The move from the rest is measured. The new target while moving is not,
+ *  and it ends at least the time of the move from the last target later.
+ *  Returns micros() the move is expected to end. The model not learned yet
+ *  expects the end at the first probe, and the probes go on until it ends.
+ *************************************************************************/
+unsigned long LensMotion::moved( int target, unsigned long nowUs )
+{
+  stat.moves++;
+  if ( moving ) {
+    unsigned long endMs = ( nowUs - moveUs ) / 1000 + predictMs( target - this->target );
+    if ( endMs > predictedMs ) predictedMs = endMs;
+    this->target = target;
+    clean = false;
+    return moveUs + predictedMs * 1000UL;
+  }
+  if ( restKnown && abs( target - restPosition ) <= MOTION_TOLERANCE ) {
+    return nowUs;   // Already there.
+  }
+  moving = true;
+  clean = restKnown;
+  this->target = target;
+  distance = abs( target - restPosition );
+  lastProbePosition = restPosition;
+  probes = 0;
+  sameProbes = 0;
+  changeUs = nowUs;
+  moveUs = nowUs;
+  movingProbeUs = 0;
+  predictedMs = isTrained() ? predictMs( distance ) : MOTION_POLLMS;
+  return moveUs + predictedMs * 1000UL;
+}
+
+// Delay of the next probe. The first one is a little before the end predicted,
+// so the end is between the probes. (ms)
+unsigned long LensMotion::probeDelayMs( unsigned long nowUs )
+{
+  if ( probes > 0 || !isTrained() ) return MOTION_POLLMS;
+  long delayMs = (long)predictedMs - MOTION_POLLMS - (long)( ( nowUs - moveUs ) / 1000 );
+  return ( delayMs > 1 ) ? delayMs : 1;
+}
+
+void LensMotion::probeSent( unsigned long nowUs )
+{
+  probeUs = nowUs;
+  stat.probes++;
+}
+
+// The probe could not be queued (the queue of the commands is full), and it is tried again.
+// It counts as a probe, so the move is given up in the end.
+int LensMotion::probeDropped( void )
+{
+  if ( !moving ) return MOTION_SETTLED;
+  if ( ++probes < MOTION_MAXPROBES ) return MOTION_MOVING;
+  stat.gaveup++;
+  moving = false;
+  restKnown = false;
+  return MOTION_GAVEUP;
+}
+
+/*************************************************************************
+ * NAME  reply -
+ *
+ * SYNOPSIS
+ *
+ *    int LensMotion::reply( int position )
+ *
+ * DESCRIPTION
+ *  The <position> replied to the probe. The move ends at the target, or when
+ *  the position stays away from the rest and the target (the end of the range)
+ *  for MOTION_STALLPROBES probes, and longer than MOTION_STALLMS and the time of
+ *  one step of the model. A slow lens may read the same position twice in a row.
+ *  The time of the move from the rest is learned.
+ *  Returns MOTION_MOVING, MOTION_SETTLED, MOTION_STALLED or MOTION_GAVEUP.
+ *************************************************************************/
+int LensMotion::reply( int position )
+{
+  int result;
+
+  if ( !moving ) {
+    this->position( position );
+    return MOTION_SETTLED;
+  }
+  probes++;
+  if ( abs( position - target ) <= MOTION_TOLERANCE ) {
+    result = MOTION_SETTLED;
+    if ( clean ) {
+      double settledMs = ( probeUs - moveUs ) / 1000.0;
+      if ( movingProbeUs != 0 ) {
+        settledMs = ( settledMs + ( movingProbeUs - moveUs ) / 1000.0 ) / 2;
+      }
+      if ( isTrained() ) {
+        unsigned long errorMs = (unsigned long)fabs( settledMs - predictedMs );
+        stat.predicted++;
+        stat.errorMsTotal += errorMs;
+        if ( errorMs > stat.errorMsMax ) stat.errorMsMax = errorMs;
+      }
+      learn( distance, settledMs );
+    }
+  } else if ( position == lastProbePosition && position != restPosition && isStalled() ) {
+    result = MOTION_STALLED;
+    stat.stalled++;
+  } else if ( probes >= MOTION_MAXPROBES ) {
+    result = MOTION_GAVEUP;
+    stat.gaveup++;
+  } else {
+    if ( position != lastProbePosition ) {
+      sameProbes = 0;
+      changeUs = probeUs;
+    }
+    lastProbePosition = position;
+    movingProbeUs = probeUs;
+    return MOTION_MOVING;
+  }
+  moving = false;
+  restPosition = position;
+  restKnown = ( result != MOTION_GAVEUP );
+  return result;
+}
+
+// Count the probe of the same position, and returns true if the lens is regarded as stopped.
+bool LensMotion::isStalled( void )
+{
+  sameProbes++;
+  double stillMs = ( probeUs - changeUs ) / 1000.0;
+  double stallMs = ( msPerStep > MOTION_STALLMS ) ? msPerStep : MOTION_STALLMS;
+  return sameProbes >= MOTION_STALLPROBES - 1 && stillMs > stallMs;
+}
+
+// The position read at rest. ("P#" of the connection and of the host)
+void LensMotion::position( int position )
+{
+  if ( moving ) return;
+  restPosition = position;
+  restKnown = true;
+}
+
+// The move is lost, and the position is not known until it is read again.
+void LensMotion::stop( void )
+{
+  moving = false;
+  restKnown = false;
+}
+
+// Add the move of the <distance> and the <timeMs>, and fit the model again.
+void LensMotion::learn( int distance, double timeMs )
+{
+  if ( distance <= MOTION_TOLERANCE ) return;
+  if ( n > MOTION_MAXSAMPLES - 1 ) {
+    double k = ( MOTION_MAXSAMPLES - 1.0 ) / n;   // Forget the older moves.
+    n *= k;
+    sumD *= k;
+    sumT *= k;
+    sumDD *= k;
+    sumDT *= k;
+  }
+  n += 1;
+  sumD += distance;
+  sumT += timeMs;
+  sumDD += (double)distance * distance;
+  sumDT += distance * timeMs;
+  fit();
+  dirty = true;
+  stat.learned++;
+}
+
+// Least squares of time = offset + msPerStep * distance.
+// The distances of nearly the same length fit the speed only. (offset 0)
+void LensMotion::fit( void )
+{
+  double det = n * sumDD - sumD * sumD;   // n^2 * variance of the distances
+  bool fitted = false;
+  if ( n >= 2 && det > n * n * (double)MOTION_MINSPREAD * MOTION_MINSPREAD ) {
+    msPerStep = ( n * sumDT - sumD * sumT ) / det;
+    offsetMs = ( sumT - msPerStep * sumD ) / n;
+    fitted = msPerStep > 0 && offsetMs >= 0;
+  }
+  if ( !fitted ) {
+    offsetMs = 0;
+    msPerStep = ( sumD > 0 ) ? sumT / sumD : 0;
+  }
+}
@@ -0,0 +1,120 @@
+// lensMotion
+
+/*
+  lensMotion.h
+    The timing model of the focus moves of one lens, learned from the moves.
+    "Mxxxx#" has no reply, so the time of a move is measured by "P#" (the probe) sent
+    about the time the move is expected to end. The time is the middle of the last probe
+    still moving and the first probe at the target, and the model is fitted to the times:
+
+      time(ms) = offset + distance / speed
+
+    by the least squares of the latest MOTION_MAXSAMPLES moves (the older ones are forgotten).
+    Only the moves from the position known at rest are learned.
+    The model is saved as "<samples> <offset ms> <speed steps/s> <mean distance> <sd distance>",
+    from which the sums of the least squares are made again.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  setLens()     Set the lens and the saved model. ("" is not learned yet)
+  toString()    The model to be saved.
+  predictMs()   Time of the move of the distance.
+  moved()       The move is sent. Returns the time the move is expected to end.
+  probeDelayMs() Delay of the next probe.
+  probeSent()   The probe is sent.
+  probeDropped() The probe could not be queued. Returns MOTION_GAVEUP after MOTION_MAXPROBES.
+  reply()       The position of the probe. Returns MOTION_MOVING until the move ends.
+  position()    The position read at rest.
+  stop()        The move is lost. (the lens controller is disconnected)
+*/
+
+#ifndef LENSMOTION_H
+#define LENSMOTION_H
+
+#include <Arduino.h>
+
+#define MOTION_POLLMS       20    // Interval of the probes while the lens is moving.
+#define MOTION_MAXPROBES    200   // The move is given up after this number of the probes.
+#define MOTION_TOLERANCE    1     // Steps from the target regarded as arrived.
+#define MOTION_MINSAMPLES   3     // The model is used after this number of the moves.
+#define MOTION_MAXSAMPLES   32    // The moves before these are forgotten.
+#define MOTION_MINSPREAD    100   // Spread of the distances (steps) for the offset to be fitted.
+#define MOTION_STALLPROBES  4     // Probes of the same position until the lens is regarded as stopped,
+#define MOTION_STALLMS      200   // and the time the position has not changed. (a slow lens reads the same position twice)
+
+#define MOTION_MOVING       0     // The lens is still moving.
+#define MOTION_SETTLED      1     // Arrived at the target.
+#define MOTION_STALLED      2     // Stopped before the target. (the end of the range)
+#define MOTION_GAVEUP       3     // Not arrived in MOTION_MAXPROBES probes.
+
+typedef struct {
+  unsigned long moves;        // Moves sent.
+  unsigned long learned;      // Moves measured and learned.
+  unsigned long probes;
+  unsigned long stalled;
+  unsigned long gaveup;
+  unsigned long errorMsTotal; // Difference of the time predicted and measured.
+  unsigned long errorMsMax;
+  unsigned long predicted;    // Moves measured with the model.
+} motionStat_t;
+
+class LensMotion
+{
+private:
+  int lensIndex;
+  double n, sumD, sumT, sumDD, sumDT;   // Sums of the least squares.
+  double offsetMs;
+  double msPerStep;
+  bool dirty;
+
+  bool moving;
+  bool restKnown;
+  bool clean;                 // The move started at rest, it can be learned.
+  int restPosition;
+  int target;
+  int distance;
+  int lastProbePosition;
+  int probes;
+  int sameProbes;             // Probes of the same position in a row.
+  unsigned long changeUs;     // The position of the probe changed last.
+  unsigned long moveUs;
+  unsigned long probeUs;
+  unsigned long movingProbeUs; // The last probe still moving, or 0.
+  unsigned long predictedMs;
+
+  void fit( void );
+  bool isStalled( void );
+  void learn( int distance, double timeMs );
+
+public:
+  LensMotion();
+  ~LensMotion();
+
+  motionStat_t stat;
+
+  void setLens( int lensIndex, String saved );
+  int lens( void );
+  String toString( void );
+  bool isDirty( void );
+  void saved( void );
+  bool isTrained( void );
+  int samples( void );
+  int offset( void );
+  int speed( void );
+  unsigned long predictMs( int distance );
+  bool isMoving( void );
+  unsigned long moved( int target, unsigned long nowUs );
+  unsigned long probeDelayMs( unsigned long nowUs );
+  void probeSent( unsigned long nowUs );
+  int probeDropped( void );
+  int reply( int position );
+  void position( int position );
+  void stop( void );
+};
+
+#endif  /* LENSMOTION_H */
@@ -0,0 +1,176 @@
+// lensPort
+
+/*
+  lensPort.cpp
+    FtdiPort on the USB host library, and SimulatedPort which answers "P#" by the time of the move.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "lensPort.h"
+
+// FtdiPort class constructor.
+FtdiPort::FtdiPort( USB *usb, uint32_t baud ) : ftdi( usb, this )
+{
+  this->baud = baud;
+  flagOnInit = false;
+}
+
+// FtdiPort class destructor.
+FtdiPort::~FtdiPort()
+{
+}
+
+// Called when the FTDI device is enumerated.
+uint8_t FtdiPort::OnInit( FTDI *pftdi )
+{
+  uint8_t rcode = 0;
+
+  rcode = pftdi->SetBaudRate( baud );  // for ASCOM Canon EF Lens Controller
+
+  if ( rcode ) {
+    Serial.printf( "rode=%d\n", rcode );
+    ErrorMessage<uint8_t>( PSTR( "SetBaudRate" ), rcode );
+    return rcode;
+  }
+  rcode = pftdi->SetFlowControl( FTDI_SIO_DISABLE_FLOW_CTRL );
+
+  if (rcode){
+    Serial.printf( "rode=%d\n", rcode );
+    ErrorMessage<uint8_t>( PSTR( "SetFlowControl" ), rcode );
+  }
+
+  Serial.println( "OnInit" );
+  flagOnInit = true;
+  return rcode;
+}
+
+// Called when the FTDI device is disconnected.
+uint8_t FtdiPort::OnRelease( FTDI *pftdi )
+{
+  flagOnInit = false;
+  return 0;
+}
+
+bool FtdiPort::isReady( void )
+{
+  return flagOnInit;
+}
+
+uint8_t FtdiPort::send( const char *command )
+{
+  return ftdi.SndData( strlen( command ), (uint8_t*)command );
+}
+
+// Take out the received bytes. Returns the number of bytes.
+int FtdiPort::receive( uint8_t *buff, int size )
+{
+  uint8_t rcode;
+  uint8_t data[64];
+
+  if ( !flagOnInit ) return 0;
+  uint16_t rcvd = 64;
+  rcode = ftdi.RcvData( &rcvd, data );
+
+  if ( rcode && rcode != hrNAK ) {
+    ErrorMessage<uint8_t>( PSTR("Ret"), rcode );
+  }
+  // The device reserves the first two bytes of data
+  //   to contain the current values of the modem and line status registers.
+  int n = 0;
+  for ( int i = 2; i < rcvd && n < size; i++ ) {
+    buff[n++] = data[i];
+  }
+  return n;
+}
+
+// SimulatedPort class constructor.
+SimulatedPort::SimulatedPort( int position )
+{
+  ready = false;
+  readyTime = 0;
+  startPosition = position;
+  targetPosition = position;
+  moveTime = 0;
+  aperture = 0;
+  commandLength = 0;
+  replyLength = 0;
+  replyTime = 0;
+}
+
+// SimulatedPort class destructor.
+SimulatedPort::~SimulatedPort()
+{
+}
+
+// Connect the simulated lens controller after <delayMs>, as the USB enumeration does.
+void SimulatedPort::connect( unsigned long delayMs )
+{
+  readyTime = millis() + delayMs;
+  ready = true;
+}
+
+bool SimulatedPort::isReady( void )
+{
+  return ready && (long)( millis() - readyTime ) >= 0;
+}
+
+// The focus position at the <now>, moving to the target at SIM_SPEED.
+int SimulatedPort::position( unsigned long now )
+{
+  long steps = (long)( ( now - moveTime ) * SIM_SPEED / 1000 );
+  int distance = abs( targetPosition - startPosition );
+  if ( steps >= distance ) return targetPosition;
+  return ( targetPosition > startPosition ) ? startPosition + steps : startPosition - steps;
+}
+
+// Execute the command received.
+void SimulatedPort::execute( void )
+{
+  unsigned long now = millis();
+  command[commandLength] = '\0';
+  switch ( command[0] ) {
+  case 'P':
+    if ( replyLength < SIM_REPLYSIZE - 8 ) {
+      replyLength += sprintf( &reply[replyLength], "%d#", position( now ) );
+      replyTime = now + SIM_REPLYMS;
+    }
+    break;
+  case 'M':
+    startPosition = position( now );
+    targetPosition = atoi( &command[1] );
+    moveTime = now;
+    break;
+  case 'A':
+    aperture = atoi( &command[1] );
+    break;
+  }
+}
+
+uint8_t SimulatedPort::send( const char *command )
+{
+  if ( !isReady() ) return 1;
+  for ( const char *p = command; *p; p++ ) {
+    if ( *p == '#' ) {
+      execute();
+      commandLength = 0;
+    } else if ( commandLength < (int)sizeof( this->command ) - 1 ) {
+      this->command[commandLength++] = *p;
+    }
+  }
+  return 0;
+}
+
+int SimulatedPort::receive( uint8_t *buff, int size )
+{
+  if ( replyLength == 0 || (long)( millis() - replyTime ) < 0 ) return 0;
+  int n = ( replyLength < size ) ? replyLength : size;
+  memcpy( buff, reply, n );
+  memmove( reply, &reply[n], replyLength - n );
+  replyLength -= n;
+  return n;
+}
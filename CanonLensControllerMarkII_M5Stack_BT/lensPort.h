@@ -0,0 +1,90 @@
+// lensPort
+
+/*
+  lensPort.h
+    The connection to one lens controller.
+    FtdiPort is the ASCOM Canon EF Lens Controller on the USB FTDI (also behind a USB hub),
+    and SimulatedPort is a lens controller simulated in the program, for the test without the devices.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  isReady()   Returns true if the lens controller is connected.
+  send()      Send a command. ("P#", "Mxxxx#", "Axx#")
+  receive()   Take out the received bytes.
+*/
+
+#ifndef LENSPORT_H
+#define LENSPORT_H
+
+#include <Arduino.h>
+#include <cdcftdi.h>
+
+#define SIM_SPEED       4000  // Focus steps per second of the simulated lens.
+#define SIM_REPLYMS     2     // Delay of the reply of the simulated lens controller.
+#define SIM_REPLYSIZE   32
+
+class LensPort
+{
+public:
+  virtual ~LensPort() {}
+  virtual bool isReady( void ) = 0;
+  virtual uint8_t send( const char *command ) = 0;
+  virtual int receive( uint8_t *buff, int size ) = 0;
+};
+
+// The lens controller on the USB FTDI.
+// Every instance claims one FTDI device enumerated by the USB host (and the hub).
+class FtdiPort : public LensPort, public FTDIAsyncOper
+{
+private:
+  FTDI ftdi;
+  uint32_t baud;
+  bool flagOnInit;
+
+public:
+  FtdiPort( USB *usb, uint32_t baud );
+  ~FtdiPort();
+
+  uint8_t OnInit( FTDI *pftdi );
+  uint8_t OnRelease( FTDI *pftdi );
+  bool isReady( void );
+  uint8_t send( const char *command );
+  int receive( uint8_t *buff, int size );
+};
+
+// The lens controller simulated in the program.
+// The focus moves at SIM_SPEED, and "P#" replies the position of the time.
+class SimulatedPort : public LensPort
+{
+private:
+  bool ready;
+  unsigned long readyTime;
+  int startPosition;
+  int targetPosition;
+  unsigned long moveTime;
+  int aperture;
+  char command[16];
+  int commandLength;
+  char reply[SIM_REPLYSIZE];
+  int replyLength;
+  unsigned long replyTime;
+
+  int position( unsigned long now );
+  void execute( void );
+
+public:
+  SimulatedPort( int position );
+  ~SimulatedPort();
+
+  void connect( unsigned long delayMs );
+  bool isReady( void );
+  uint8_t send( const char *command );
+  int receive( uint8_t *buff, int size );
+};
+
+#endif  /* LENSPORT_H */
@@ -0,0 +1,312 @@
+// memTelemetry
+
+/*
+  memTelemetry.cpp
+    MemTelemetry samples the heap by ESP-IDF, and counts the allocations of the subsystems.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "memTelemetry.h"
+#include <esp_heap_caps.h>
+
+static const char *subsystemName[MEM_SUBSYSTEMS] = {
+  "system", "loop", "usb", "bt", "ui", "timer", "recorder", "config"
+};
+
+volatile uint8_t MemTelemetry::subsystem = MEM_LOOP;
+volatile uint32_t MemTelemetry::allocs[MEM_SUBSYSTEMS];
+volatile uint32_t MemTelemetry::frees[MEM_SUBSYSTEMS];
+volatile uint32_t MemTelemetry::allocBytes[MEM_SUBSYSTEMS];
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+// Called by the heap of ESP-IDF on every allocation and free, on both cores.
+extern "C" void IRAM_ATTR esp_heap_trace_alloc_hook( void *ptr, size_t size, uint32_t caps )
+{
+  MemTelemetry::countAlloc( size );
+}
+
+extern "C" void IRAM_ATTR esp_heap_trace_free_hook( void *ptr )
+{
+  MemTelemetry::countFree();
+}
+#endif
+
+// MemTelemetry class constructor.
+MemTelemetry::MemTelemetry()
+{
+  historyCount = 0;
+  historyNext = 0;
+  historyMs = MEM_HISTORYMS;
+  historyTime = 0;
+  numberOfTasks = 0;
+  memset( retained, 0, sizeof( retained ) );
+  alarmFree = 0;
+  alarmLargest = 0;
+  alarmStack = 0;
+  freeBytes = 0;
+  largest = 0;
+  minimum = 0;
+  largestMin = 0;
+  baseFree = 0;
+  baseLargest = 0;
+  baseTime = 0;
+  stackMin = 0;
+  stackMinName = "";
+  alarms = 0;
+  alarmCount = 0;
+  samples = 0;
+}
+
+// MemTelemetry class destructor.
+MemTelemetry::~MemTelemetry()
+{
+}
+
+// Set the interval of the history and the thresholds of the alarms. (0 is no alarm)
+void MemTelemetry::begin( unsigned long historyMs, uint32_t alarmFree, uint32_t alarmLargest, uint32_t alarmStack )
+{
+  this->historyMs = historyMs;
+  this->alarmFree = alarmFree;
+  this->alarmLargest = alarmLargest;
+  this->alarmStack = alarmStack;
+}
+
+// Add the task of the stack high-water mark.
+// The task of the handle NULL is looked up by the name at every sample until it is found,
+// for the tasks started by the libraries.
+void MemTelemetry::addTask( const char *name, TaskHandle_t handle )
+{
+  if ( numberOfTasks >= MEM_MAXTASKS ) return;
+  memTask_t *t = &task[numberOfTasks++];
+  t->name = name;
+  t->handle = handle;
+  t->stackFree = 0;
+  t->finished = false;
+}
+
+// Keep the last stack high-water mark of the task ended. (measured by the task before vTaskDelete())
+void MemTelemetry::taskFinished( const char *name, uint32_t stackFree )
+{
+  for ( int i = 0; i < numberOfTasks; i++ ) {
+    if ( strcmp( task[i].name, name ) == 0 ) {
+      task[i].stackFree = stackFree;
+      task[i].finished = true;
+      return;
+    }
+  }
+  addTask( name, NULL );
+  taskFinished( name, stackFree );
+}
+
+// Tag the allocations from here to the <subsystem>. Keep the returned scope for leave().
+memScope_t MemTelemetry::enter( uint8_t subsystem )
+{
+  memScope_t scope;
+  scope.previous = MemTelemetry::subsystem;
+  scope.freeBytes = heap_caps_get_free_size( MALLOC_CAP_DEFAULT );
+  MemTelemetry::subsystem = subsystem;
+  return scope;
+}
+
+// Back to the subsystem before enter(). The heap kept by the subsystem is added,
+// and the nested subsystem is counted also in the outer one.
+// Without the heap hooks, the heap taken or given back in the scope is counted as one allocation or free.
+void MemTelemetry::leave( memScope_t scope )
+{
+  uint8_t s = MemTelemetry::subsystem;
+  long kept = (long)scope.freeBytes - (long)heap_caps_get_free_size( MALLOC_CAP_DEFAULT );
+  retained[s] += kept;
+#ifndef CONFIG_HEAP_USE_HOOKS
+  if ( kept > 0 ) {
+    allocs[s]++;
+    allocBytes[s] += kept;
+  } else if ( kept < 0 ) {
+    frees[s]++;
+  }
+#endif
+  MemTelemetry::subsystem = scope.previous;
+}
+
+// Count the allocation to the subsystem of the loop. The other core is "system".
+// The counters are not locked, a count lost by the both cores at once is allowed.
+void IRAM_ATTR MemTelemetry::countAlloc( size_t size )
+{
+  uint8_t s = ( xPortGetCoreID() == ARDUINO_RUNNING_CORE ) ? subsystem : MEM_SYSTEM;
+  allocs[s]++;
+  allocBytes[s] += size;
+}
+
+void IRAM_ATTR MemTelemetry::countFree( void )
+{
+  uint8_t s = ( xPortGetCoreID() == ARDUINO_RUNNING_CORE ) ? subsystem : MEM_SYSTEM;
+  frees[s]++;
+}
+
+// Stack high-water marks of the tasks. (bytes on ESP-IDF)
+void MemTelemetry::sampleTasks( void )
+{
+  stackMin = 0;
+  stackMinName = "";
+  for ( int i = 0; i < numberOfTasks; i++ ) {
+    memTask_t *t = &task[i];
+    if ( !t->finished ) {
+      if ( t->handle == NULL ) {
+        t->handle = xTaskGetHandle( t->name );
+        if ( t->handle == NULL ) continue;  // Not started yet.
+      }
+      t->stackFree = uxTaskGetStackHighWaterMark( t->handle );
+    }
+    if ( stackMin == 0 || t->stackFree < stackMin ) {
+      stackMin = t->stackFree;
+      stackMinName = t->name;
+    }
+  }
+}
+
+// Returns true while the <value> is under the <threshold> of the alarm <bit>.
+// The alarm raised is cleared at MEM_HYSTERESIS above the threshold.
+bool MemTelemetry::isUnder( uint8_t bit, uint32_t value, uint32_t threshold )
+{
+  if ( threshold == 0 ) return false;
+  if ( alarms & bit ) {
+    return value < threshold + threshold / MEM_HYSTERESIS;
+  }
+  return value < threshold;
+}
+
+uint8_t MemTelemetry::checkAlarms( void )
+{
+  uint8_t now = 0;
+  if ( isUnder( MEMALARM_FREE, freeBytes, alarmFree ) ) now |= MEMALARM_FREE;
+  if ( isUnder( MEMALARM_LARGEST, largest, alarmLargest ) ) now |= MEMALARM_LARGEST;
+  if ( stackMin > 0 && isUnder( MEMALARM_STACK, stackMin, alarmStack ) ) now |= MEMALARM_STACK;
+  uint8_t raised = now & ~alarms;
+  if ( raised ) alarmCount++;
+  alarms = now;
+  return raised;
+}
+
+/*************************************************************************
+ * NAME  sample -
+ *
+ * SYNOPSIS
+ *
+ *    uint8_t MemTelemetry::sample( unsigned long now )
+ *
+ * DESCRIPTION
+ *  Sample the free heap, the largest free block and the stack high-water marks,
+ *  and check them by the thresholds. The sample is added to the history every
+ *  historyMs. The first sample is the base of the drift.
+ *  Returns the alarm bits raised by this sample.
+ *************************************************************************/
+uint8_t MemTelemetry::sample( unsigned long now )
+{
+  freeBytes = heap_caps_get_free_size( MALLOC_CAP_DEFAULT );
+  largest = heap_caps_get_largest_free_block( MALLOC_CAP_DEFAULT );
+  minimum = heap_caps_get_minimum_free_size( MALLOC_CAP_DEFAULT );
+  sampleTasks();
+  if ( samples == 0 || largest < largestMin ) largestMin = largest;
+  if ( samples == 0 ) {
+    baseFree = freeBytes;
+    baseLargest = largest;
+    baseTime = now;
+  }
+  samples++;
+
+  if ( historyCount == 0 || (long)( now - historyTime ) >= (long)historyMs ) {
+    memSample_t *h = &history[historyNext];
+    h->time = now;
+    h->freeBytes = freeBytes;
+    h->largest = largest;
+    h->stackMin = stackMin;
+    historyNext = ( historyNext + 1 ) % MEM_HISTORY;
+    if ( historyCount < MEM_HISTORY ) historyCount++;
+    historyTime = now;
+  }
+  return checkAlarms();
+}
+
+// Fragmentation of the free heap. (percent, 0 is one free block)
+int MemTelemetry::fragmentation( void )
+{
+  if ( freeBytes == 0 ) return 0;
+  return 100 - (int)( (uint64_t)largest * 100 / freeBytes );
+}
+
+// Allocations counted by the heap hooks of all of the subsystems.
+// Without the hooks, the blocks in use of the heap.
+uint32_t MemTelemetry::totalAllocs( void )
+{
+#ifdef CONFIG_HEAP_USE_HOOKS
+  uint32_t total = 0;
+  for ( int i = 0; i < MEM_SUBSYSTEMS; i++ ) total += allocs[i];
+  return total;
+#else
+  multi_heap_info_t info;
+  heap_caps_get_info( &info, MALLOC_CAP_DEFAULT );
+  return info.allocated_blocks;
+#endif
+}
+
+// Bytes allocated counted by the heap hooks. Without the hooks, the bytes in use of the heap.
+uint32_t MemTelemetry::totalBytes( void )
+{
+#ifdef CONFIG_HEAP_USE_HOOKS
+  uint32_t total = 0;
+  for ( int i = 0; i < MEM_SUBSYSTEMS; i++ ) total += allocBytes[i];
+  return total;
+#else
+  multi_heap_info_t info;
+  heap_caps_get_info( &info, MALLOC_CAP_DEFAULT );
+  return info.total_allocated_bytes;
+#endif
+}
+
+// Make the "H" message of the latest sample.
+// H<free> <largest> <minimum> <stack> <alarms> <fragmentation>#
+int MemTelemetry::summary( char *buff, int size )
+{
+  return snprintf( buff, size, "H%u %u %u %u %u %d#", (unsigned)freeBytes, (unsigned)largest, (unsigned)minimum,
+                   (unsigned)stackMin, alarms, fragmentation() );
+}
+
+// Print the telemetry to the serial.
+void MemTelemetry::report( void )
+{
+  Serial.printf( "mem free=%u largest=%u frag=%d%% minimum=%u largest min=%u alarms=0x%02X (%lu)\n",
+                 (unsigned)freeBytes, (unsigned)largest, fragmentation(), (unsigned)minimum,
+                 (unsigned)largestMin, alarms, alarmCount );
+  Serial.printf( "  drift free=%ld largest=%ld in %lu min\n",
+                 (long)freeBytes - (long)baseFree, (long)largest - (long)baseLargest, ( millis() - baseTime ) / 60000 );
+#ifdef CONFIG_HEAP_USE_HOOKS
+  for ( int i = 0; i < MEM_SUBSYSTEMS; i++ ) {
+    Serial.printf( "  %-10s allocs=%lu frees=%lu bytes=%lu retained=%ld\n", subsystemName[i],
+                   (unsigned long)allocs[i], (unsigned long)frees[i], (unsigned long)allocBytes[i], retained[i] );
+  }
+#else
+  Serial.printf( "  heap blocks=%lu bytes=%lu (no heap hooks, the allocations are sampled at enter and leave)\n",
+                 (unsigned long)totalAllocs(), (unsigned long)totalBytes() );
+  for ( int i = MEM_LOOP; i < MEM_SUBSYSTEMS; i++ ) {
+    Serial.printf( "  %-10s allocs=%lu(sampled) frees=%lu(sampled) bytes=%lu retained=%ld\n", subsystemName[i],
+                   (unsigned long)allocs[i], (unsigned long)frees[i], (unsigned long)allocBytes[i], retained[i] );
+  }
+#endif
+  for ( int i = 0; i < numberOfTasks; i++ ) {
+    if ( task[i].handle == NULL && !task[i].finished ) {
+      Serial.printf( "  stack %-12s not started\n", task[i].name );
+    } else {
+      Serial.printf( "  stack %-12s free=%u%s\n", task[i].name, (unsigned)task[i].stackFree, task[i].finished ? " (ended)" : "" );
+    }
+  }
+  int first = ( historyNext - historyCount + MEM_HISTORY ) % MEM_HISTORY;
+  for ( int i = 0; i < historyCount; i++ ) {
+    memSample_t *h = &history[( first + i ) % MEM_HISTORY];
+    Serial.printf( "  %6lu min free=%u largest=%u stack=%u\n", h->time / 60000,
+                   (unsigned)h->freeBytes, (unsigned)h->largest, (unsigned)h->stackMin );
+  }
+}
@@ -0,0 +1,139 @@
+// memTelemetry
+
+/*
+  memTelemetry.h
+    The heap and stack telemetry, to see that the memory stays flat in a long session.
+    The free heap, the largest free block (fragmentation) and the stack high-water marks of the tasks
+    are sampled by the timer, and the alarm is raised when one of them goes under the threshold.
+    The history of the samples is kept for about 10 hours at the default interval.
+    The loop tags the work of each subsystem by enter() and leave(), and leave() adds the heap
+    kept by the subsystem.
+    The stock Arduino core is built without the heap hooks of ESP-IDF, and the allocations of the
+    subsystems are sampled: leave() compares the free heap with the one at enter(), and a scope that
+    took the heap counts as one allocation of the bytes taken, a scope that gave it back as one free.
+    So the allocations freed in the same scope are not seen, and those of the other core at the same
+    time are added to the subsystem. totalAllocs() and totalBytes() give the blocks and the bytes
+    in use of the whole heap, so their difference is the net allocations.
+    With CONFIG_HEAP_USE_HOOKS=y in the sdkconfig (the core built by the lib-builder, or Arduino as
+    an ESP-IDF component) every allocation is counted by the hooks, and those on the other core
+    (the Bluetooth stack) go to "system".
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  begin()         Set the history interval and the alarm thresholds.
+  addTask()       Add the task of the stack high-water mark. (the handle NULL is looked up by the name)
+  taskFinished()  Keep the stack high-water mark of the task ended.
+  enter()         Tag the allocations to the subsystem.
+  leave()         Back to the previous subsystem, and add the heap kept.
+  sample()        Sample the heap and the stacks. Returns the alarms raised.
+  summary()       Make the "H" message.
+  report()        Print the telemetry to the serial.
+*/
+
+#ifndef MEMTELEMETRY_H
+#define MEMTELEMETRY_H
+
+#include <Arduino.h>
+
+#define MEM_SUBSYSTEMS    8
+#define MEM_SYSTEM        0     // The other core. (the Bluetooth stack)
+#define MEM_LOOP          1     // The loop and setup, out of the subsystems below.
+#define MEM_USB           2     // USB host and the lens controllers.
+#define MEM_BT            3     // Bluetooth serial messages.
+#define MEM_UI            4     // Keys, encoder and display.
+#define MEM_TIMER         5     // Timer handlers.
+#define MEM_RECORDER      6     // Session recorder.
+#define MEM_CONFIG        7     // Settings file and lens list on the SD card.
+
+#define MEM_HISTORY       64    // samples of the history (64 * 10 minutes is 10.6 hours)
+#define MEM_MAXTASKS      6     // tasks of the stack high-water mark
+#define MEM_SAMPLEMS      10000 // Interval of the samples for the alarms.
+#define MEM_HISTORYMS     600000  // Interval of the history.
+#define MEM_HYSTERESIS    8     // The alarm is cleared at 1/8 above the threshold.
+
+#define MEMALARM_FREE     0x01  // Free heap under the threshold.
+#define MEMALARM_LARGEST  0x02  // Largest free block under the threshold. (fragmentation)
+#define MEMALARM_STACK    0x04  // Stack left of a task under the threshold.
+
+typedef struct {
+  unsigned long time;         // millis()
+  uint32_t freeBytes;
+  uint32_t largest;
+  uint32_t stackMin;
+} memSample_t;
+
+typedef struct {
+  const char *name;
+  TaskHandle_t handle;
+  uint32_t stackFree;         // High-water mark, bytes never used.
+  bool finished;              // Ended, the last high-water mark is kept.
+} memTask_t;
+
+typedef struct {
+  uint8_t previous;           // Subsystem before enter().
+  uint32_t freeBytes;         // Free heap at enter().
+} memScope_t;
+
+class MemTelemetry
+{
+private:
+  memSample_t history[MEM_HISTORY];
+  int historyCount;
+  int historyNext;
+  unsigned long historyMs;
+  unsigned long historyTime;
+  memTask_t task[MEM_MAXTASKS];
+  int numberOfTasks;
+  long retained[MEM_SUBSYSTEMS];  // Heap kept by the subsystem, from the free heap at enter() and leave().
+  uint32_t alarmFree;
+  uint32_t alarmLargest;
+  uint32_t alarmStack;
+
+  void sampleTasks( void );
+  uint8_t checkAlarms( void );
+  bool isUnder( uint8_t bit, uint32_t value, uint32_t threshold );
+
+public:
+  MemTelemetry();
+  ~MemTelemetry();
+
+  // Counted by the heap hooks on both cores, or sampled by leave() without the hooks.
+  static volatile uint8_t subsystem;
+  static volatile uint32_t allocs[MEM_SUBSYSTEMS];
+  static volatile uint32_t frees[MEM_SUBSYSTEMS];
+  static volatile uint32_t allocBytes[MEM_SUBSYSTEMS];
+
+  uint32_t freeBytes;
+  uint32_t largest;
+  uint32_t minimum;           // Lowest free heap since the reset, by ESP-IDF.
+  uint32_t largestMin;        // Lowest largest free block sampled.
+  uint32_t baseFree;          // The first sample, after the boot.
+  uint32_t baseLargest;
+  unsigned long baseTime;
+  uint32_t stackMin;          // Lowest stack left of the tasks.
+  const char *stackMinName;
+  uint8_t alarms;
+  unsigned long alarmCount;
+  unsigned long samples;
+
+  void begin( unsigned long historyMs, uint32_t alarmFree, uint32_t alarmLargest, uint32_t alarmStack );
+  void addTask( const char *name, TaskHandle_t handle );
+  void taskFinished( const char *name, uint32_t stackFree );
+  memScope_t enter( uint8_t subsystem );
+  void leave( memScope_t scope );
+  uint8_t sample( unsigned long now );
+  int fragmentation( void );
+  uint32_t totalAllocs( void );
+  uint32_t totalBytes( void );
+  int summary( char *buff, int size );
+  void report( void );
+  static void countAlloc( size_t size );
+  static void countFree( void );
+};
+
+#endif  /* MEMTELEMETRY_H */
@@ -0,0 +1,123 @@
+// motionStore
+
+/*
+  motionStore.cpp
+    MotionStore reads the file line by line, and writes it again with the lens written first.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "motionStore.h"
+
+// MotionStore class constructor.
+MotionStore::MotionStore()
+{
+  filepath = NULL;
+}
+
+// MotionStore class destructor.
+MotionStore::~MotionStore()
+{
+}
+
+void MotionStore::begin( const char *path )
+{
+  filepath = path;
+}
+
+// Read one line. CR is skipped, and the line longer than MOTION_LINEMAX is cut.
+// Returns false at the end of the file.
+bool MotionStore::readLine( File &file, char *buff )
+{
+  char *p = buff;
+  bool valid = false;
+  while ( file.available() ) {
+    uint8_t data = file.read();
+    valid = true;
+    if ( data == 0x0d ) continue;
+    if ( data == 0x0a ) break;
+    if ( p < &buff[MOTION_LINEMAX - 1] ) {
+      *p++ = data;
+    }
+  }
+  *p = '\0';
+  return valid;
+}
+
+// Returns true if the <line> is the model of the <lensName>. The spaces around the name are ignored.
+bool MotionStore::isLens( const char *line, const char *lensName )
+{
+  const char *separator = strchr( line, '|' );
+  if ( separator == NULL ) return false;
+  while ( *line == ' ' ) line++;
+  while ( separator > line && separator[-1] == ' ' ) separator--;
+  int length = separator - line;
+  return length == (int)strlen( lensName ) && strncmp( line, lensName, length ) == 0;
+}
+
+// The model of the <lensName>, or "" if it is not in the file.
+String MotionStore::read( fs::FS &fs, const char *lensName )
+{
+  char buff[MOTION_LINEMAX];
+
+  if ( filepath == NULL ) return "";
+  File file = fs.open( filepath, FILE_READ );
+  if ( !file ) return "";
+  String model = "";
+  while ( readLine( file, buff ) ) {
+    if ( isLens( buff, lensName ) ) {
+      model = String( strchr( buff, '|' ) + 1 );
+      model.trim();
+      break;
+    }
+  }
+  file.close();
+  return model;
+}
+
+/*************************************************************************
+ * NAME  write -
+ *
+ * SYNOPSIS
+ *
+ *    bool MotionStore::write( fs::FS &fs, const char *lensName, const String &model )
+ *
+ * DESCRIPTION
+ *  Write the <model> of the <lensName> as the first line, followed by the
+ *  models of the other lenses up to MOTION_MAXLENSES lines in all.
+ *  The old line of the lens is removed.
+ *  Returns false if the file can not be written, and the model is kept dirty.
+ *************************************************************************/
+bool MotionStore::write( fs::FS &fs, const char *lensName, const String &model )
+{
+  char buff[MOTION_LINEMAX];
+
+  if ( filepath == NULL ) return false;
+  String *lines = new String[MOTION_MAXLENSES];
+  int count = 0;
+  lines[count++] = String( lensName ) + " | " + model;
+  File file = fs.open( filepath, FILE_READ );
+  if ( file ) {
+    while ( count < MOTION_MAXLENSES && readLine( file, buff ) ) {
+      if ( strchr( buff, '|' ) == NULL || isLens( buff, lensName ) ) continue;
+      lines[count++] = String( buff );
+    }
+    file.close();
+  }
+
+  bool written = false;
+  file = fs.open( filepath, FILE_WRITE );
+  if ( file ) {
+    written = true;
+    for ( int n = 0; n < count && written; n++ ) {
+      written = file.println( lines[n] ) > lines[n].length();   // The line and the line end.
+    }
+    file.close();
+  }
+  delete [] lines;
+  return written;
+}
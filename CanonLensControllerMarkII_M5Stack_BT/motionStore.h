@@ -0,0 +1,50 @@
+// motionStore
+
+/*
+  motionStore.h
+    The file of the timing models of the focus moves, one line for each lens:
+
+      <lens name> | <samples> <offset ms> <speed steps/s> <mean distance> <sd distance>
+
+    The line is found by the lens name, so the model stays with the lens when the lens list is edited.
+    The lens written last is the first line, and only MOTION_MAXLENSES lenses are kept,
+    so the lens not learned for the longest time is dropped.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  begin()     Set the file name.
+  read()      The model of the lens, or "" if not learned yet.
+  write()     Write the model of the lens at the top. Returns false if the file is not written.
+*/
+
+#ifndef MOTIONSTORE_H
+#define MOTIONSTORE_H
+
+#include <M5Stack.h>
+
+#define MOTION_MAXLENSES  32    // lenses of the models kept in the file
+#define MOTION_LINEMAX    128   // max length of one line
+
+class MotionStore
+{
+private:
+  const char *filepath;
+
+  bool readLine( File &file, char *buff );
+  static bool isLens( const char *line, const char *lensName );
+
+public:
+  MotionStore();
+  ~MotionStore();
+
+  void begin( const char *path );
+  String read( fs::FS &fs, const char *lensName );
+  bool write( fs::FS &fs, const char *lensName, const String &model );
+};
+
+#endif  /* MOTIONSTORE_H */
@@ -0,0 +1,150 @@
+// resumeStore
+
+/*
+  resumeStore.cpp
+    ResumeStore writes the checkpoint to the two slot files in turn, each with the sequence and the checksum.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "resumeStore.h"
+#include <stddef.h>
+
+// Kept over the reset except the power on. The content is checked by load().
+RTC_NOINIT_ATTR static resumeCheckpoint_t rtcCheckpoint;
+
+// ResumeStore class constructor.
+ResumeStore::ResumeStore()
+{
+  pathFormat = NULL;
+  memset( &latest, 0, sizeof( latest ) );
+  dirty = false;
+  nextSlot = 0;
+  saved = 0;
+  flushed = 0;
+}
+
+// ResumeStore class destructor.
+ResumeStore::~ResumeStore()
+{
+}
+
+void ResumeStore::begin( const char *pathFormat )
+{
+  this->pathFormat = pathFormat;
+}
+
+// FNV-1a of the checkpoint, without the checksum itself.
+uint32_t ResumeStore::checksum( const resumeCheckpoint_t *checkpoint )
+{
+  const uint8_t *p = (const uint8_t *)checkpoint;
+  uint32_t hash = 2166136261UL;
+  for ( size_t i = 0; i < offsetof( resumeCheckpoint_t, checksum ); i++ ) {
+    hash = ( hash ^ p[i] ) * 16777619UL;
+  }
+  return hash;
+}
+
+bool ResumeStore::isValid( const resumeCheckpoint_t *checkpoint, size_t size )
+{
+  return checkpoint->magic == RESUME_MAGIC && checkpoint->length == size && checkpoint->checksum == checksum( checkpoint );
+}
+
+bool ResumeStore::readSlot( fs::FS &fs, int slot, resumeCheckpoint_t *checkpoint, size_t size )
+{
+  char path[32];
+
+  snprintf( path, sizeof( path ), pathFormat, slot );
+  File file = fs.open( path, FILE_READ );
+  if ( !file ) return false;
+  bool valid = file.read( (uint8_t *)checkpoint, sizeof( *checkpoint ) ) == sizeof( *checkpoint ) && isValid( checkpoint, size );
+  file.close();
+  return valid;
+}
+
+/*************************************************************************
+ * NAME  load -
+ *
+ * SYNOPSIS
+ *
+ *    int ResumeStore::load( fs::FS &fs, void *data, size_t size )
+ *
+ * DESCRIPTION
+ *  Load the newest valid checkpoint of the <size> bytes to the <data>.
+ *  The RTC memory and the slots of the file are looked at.
+ *  The next save() goes on from the sequence loaded, and the next flush()
+ *  writes the slot not loaded. It is called at every boot the checkpoints
+ *  are saved, also when the state loaded is not used.
+ *  Returns RESUME_RTC or RESUME_FILE, or RESUME_NONE if nothing is valid.
+ *************************************************************************/
+int ResumeStore::load( fs::FS &fs, void *data, size_t size )
+{
+  resumeCheckpoint_t checkpoint;
+  int source = RESUME_NONE;
+  bool fileFound = false;
+  uint32_t fileSequence = 0;
+
+  if ( size > RESUME_MAXBYTES ) return RESUME_NONE;
+  if ( isValid( &rtcCheckpoint, size ) ) {
+    latest = rtcCheckpoint;
+    source = RESUME_RTC;
+  }
+  for ( int slot = 0; pathFormat && slot < RESUME_SLOTS; slot++ ) {
+    if ( !readSlot( fs, slot, &checkpoint, size ) ) continue;
+    if ( !fileFound || checkpoint.sequence > fileSequence ) {
+      fileFound = true;
+      fileSequence = checkpoint.sequence;
+      nextSlot = ( slot + 1 ) % RESUME_SLOTS;   // The slot after the newest one is the older one.
+    }
+    if ( source == RESUME_NONE || checkpoint.sequence > latest.sequence ) {
+      latest = checkpoint;
+      source = RESUME_FILE;
+    }
+  }
+  if ( source == RESUME_NONE ) return RESUME_NONE;
+  memcpy( data, latest.data, size );
+  return source;
+}
+
+// Save the state to the RTC memory. It is only a copy, the loop is not kept waiting.
+void ResumeStore::save( const void *data, size_t size )
+{
+  if ( size > RESUME_MAXBYTES ) return;
+  latest.magic = RESUME_MAGIC;
+  latest.sequence++;
+  latest.length = size;
+  latest.reserved = 0;
+  memcpy( latest.data, data, size );
+  latest.checksum = checksum( &latest );
+  rtcCheckpoint = latest;
+  dirty = true;
+  saved++;
+}
+
+// Returns true if the latest state is not written to the file.
+bool ResumeStore::isDirty( void )
+{
+  return dirty;
+}
+
+// Write the latest state to the older slot of the file.
+bool ResumeStore::flush( fs::FS &fs )
+{
+  char path[32];
+
+  if ( !dirty || pathFormat == NULL ) return true;
+  snprintf( path, sizeof( path ), pathFormat, nextSlot );
+  File file = fs.open( path, FILE_WRITE );
+  if ( !file ) return false;
+  bool written = file.write( (const uint8_t *)&latest, sizeof( latest ) ) == sizeof( latest );
+  file.close();
+  if ( !written ) return false;
+  nextSlot = ( nextSlot + 1 ) % RESUME_SLOTS;
+  dirty = false;
+  flushed++;
+  return true;
+}
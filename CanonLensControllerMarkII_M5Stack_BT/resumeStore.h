@@ -0,0 +1,71 @@
+// resumeStore
+
+/*
+  resumeStore.h
+    The checkpoint of the session state, for the warm resume after a reset.
+    save() copies the state to the RTC memory kept over the reset (RTC_NOINIT), it is only a copy.
+    The file on the SD card is written by flush() when the state stays, for the brownout and the power loss.
+    The file has two slots written in turn, so a write broken by the reset leaves the other one.
+    The checkpoint is checked by the magic, the length and the checksum, the newest valid one is loaded.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  begin()     Set the file name of the slots. ("%d" is the slot number)
+  load()      Load the newest valid checkpoint. Returns RESUME_RTC, RESUME_FILE or RESUME_NONE.
+  save()      Save the state to the RTC memory. The file is written by flush().
+  flush()     Write the latest state to the older slot of the file.
+*/
+
+#ifndef RESUMESTORE_H
+#define RESUMESTORE_H
+
+#include <M5Stack.h>
+
+#define RESUME_MAXBYTES   64          // size of the state kept
+#define RESUME_MAGIC      0x314B4C43  // "CLK1", changed with the layout of the checkpoint
+#define RESUME_SLOTS      2           // slots of the file
+#define RESUME_NONE       0
+#define RESUME_RTC        1           // Loaded from the RTC memory.
+#define RESUME_FILE       2           // Loaded from the file.
+
+typedef struct {
+  uint32_t magic;
+  uint32_t sequence;          // The newer checkpoint is larger.
+  uint16_t length;            // Bytes of the data.
+  uint16_t reserved;
+  uint8_t data[RESUME_MAXBYTES];
+  uint32_t checksum;          // FNV-1a of the above.
+} resumeCheckpoint_t;
+
+class ResumeStore
+{
+private:
+  const char *pathFormat;
+  resumeCheckpoint_t latest;  // Written to the file by flush().
+  bool dirty;
+  int nextSlot;
+
+  static uint32_t checksum( const resumeCheckpoint_t *checkpoint );
+  bool isValid( const resumeCheckpoint_t *checkpoint, size_t size );
+  bool readSlot( fs::FS &fs, int slot, resumeCheckpoint_t *checkpoint, size_t size );
+
+public:
+  ResumeStore();
+  ~ResumeStore();
+
+  unsigned long saved;        // Checkpoints to the RTC memory.
+  unsigned long flushed;      // Checkpoints to the file.
+
+  void begin( const char *pathFormat );
+  int load( fs::FS &fs, void *data, size_t size );
+  void save( const void *data, size_t size );
+  bool isDirty( void );
+  bool flush( fs::FS &fs );
+};
+
+#endif  /* RESUMESTORE_H */
@@ -0,0 +1,192 @@
+// sessionRecorder
+
+/*
+  sessionRecorder.cpp
+    SessionRecorder keeps the records in a ring, and writes the file a little in each loop.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "sessionRecorder.h"
+
+// SessionRecorder class constructor.
+SessionRecorder::SessionRecorder()
+{
+  recording = false;
+  ringHead = 0;
+  ringCount = 0;
+  records = 0;
+  overflow = 0;
+}
+
+// SessionRecorder class destructor.
+SessionRecorder::~SessionRecorder()
+{
+}
+
+// Create the record file and write the header.
+bool SessionRecorder::begin( fs::FS &fs, const char *path )
+{
+  uint8_t header[REC_HEADERSIZE] = { 'C', 'L', 'C', 'R', REC_VERSION & 0xFF, REC_VERSION >> 8, 0, 0 };
+
+  file = fs.open( path, FILE_WRITE );
+  if ( !file ) return false;
+  file.write( header, REC_HEADERSIZE );
+  startTime = millis();
+  flushTime = startTime;
+  ringHead = 0;
+  ringCount = 0;
+  records = 0;
+  overflow = 0;
+  recording = true;
+  return true;
+}
+
+// Write out the rest of the ring buffer and close the file.
+void SessionRecorder::end( void )
+{
+  if ( !recording ) return;
+  flush( true );
+  file.close();
+  recording = false;
+}
+
+bool SessionRecorder::isRecording( void )
+{
+  return recording;
+}
+
+// Put the bytes into the ring buffer. The caller checks the free space.
+void SessionRecorder::put( const void *data, int length )
+{
+  const uint8_t *p = (const uint8_t *)data;
+  for ( int i = 0; i < length; i++ ) {
+    ring[( ringHead + ringCount ) % REC_RINGSIZE] = *p++;
+    ringCount++;
+  }
+}
+
+// Add one record. The record is dropped out when the ring buffer is full,
+// so the file never has a broken record.
+void SessionRecorder::record( uint8_t type, const void *data, int length )
+{
+  if ( !recording ) return;
+  if ( length > REC_MAXDATA ) length = REC_MAXDATA;
+  if ( ringCount + 6 + length > REC_RINGSIZE ) {
+    overflow++;
+    return;
+  }
+  uint32_t time = millis() - startTime;
+  uint8_t head[6] = { (uint8_t)time, (uint8_t)( time >> 8 ), (uint8_t)( time >> 16 ), (uint8_t)( time >> 24 ), type, (uint8_t)length };
+  put( head, 6 );
+  put( data, length );
+  records++;
+}
+
+void SessionRecorder::record( uint8_t type, const char *str )
+{
+  record( type, str, strlen( str ) );
+}
+
+// Write the ring buffer to the file. Called from loop().
+// At most REC_FLUSHSIZE bytes are written at once, unless <force>.
+void SessionRecorder::flush( bool force )
+{
+  if ( !recording ) return;
+  if ( !force && ringCount < REC_FLUSHSIZE && ( millis() - flushTime ) < REC_FLUSHMS ) return;
+
+  int total = 0;
+  while ( ringCount > 0 && ( force || total < REC_FLUSHSIZE ) ) {
+    int n = REC_RINGSIZE - ringHead;  // contiguous bytes
+    if ( n > ringCount ) n = ringCount;
+    if ( !force && n > REC_FLUSHSIZE - total ) n = REC_FLUSHSIZE - total;
+    file.write( &ring[ringHead], n );
+    ringHead = ( ringHead + n ) % REC_RINGSIZE;
+    ringCount -= n;
+    total += n;
+  }
+  file.flush();
+  flushTime = millis();
+}
+
+// SessionReplayer class constructor.
+SessionReplayer::SessionReplayer()
+{
+  replaying = false;
+  hasLookahead = false;
+}
+
+// SessionReplayer class destructor.
+SessionReplayer::~SessionReplayer()
+{
+}
+
+// Open the record file and check the header.
+bool SessionReplayer::begin( fs::FS &fs, const char *path )
+{
+  uint8_t header[REC_HEADERSIZE];
+
+  file = fs.open( path, FILE_READ );
+  if ( !file ) return false;
+  if ( file.read( header, REC_HEADERSIZE ) != REC_HEADERSIZE || memcmp( header, "CLCR", 4 ) != 0 || header[4] != REC_VERSION ) {
+    file.close();
+    return false;
+  }
+  replaying = true;
+  hasLookahead = false;
+  return true;
+}
+
+void SessionReplayer::end( void )
+{
+  if ( !replaying ) return;
+  file.close();
+  replaying = false;
+}
+
+bool SessionReplayer::isReplaying( void )
+{
+  return replaying;
+}
+
+// Read one record from the file.
+bool SessionReplayer::read( sessionRecord_t *rec )
+{
+  uint8_t head[6];
+
+  if ( file.read( head, 6 ) != 6 ) return false;
+  rec->time = head[0] | ( head[1] << 8 ) | ( (uint32_t)head[2] << 16 ) | ( (uint32_t)head[3] << 24 );
+  rec->type = head[4];
+  rec->length = ( head[5] > REC_MAXDATA ) ? REC_MAXDATA : head[5];
+  if ( file.read( rec->data, rec->length ) != rec->length ) return false;
+  rec->data[rec->length] = '\0';
+  return true;
+}
+
+// Take out the next record. Returns false at the end of the file.
+bool SessionReplayer::next( sessionRecord_t *rec )
+{
+  if ( !replaying ) return false;
+  if ( hasLookahead ) {
+    *rec = lookahead;
+    hasLookahead = false;
+    return true;
+  }
+  return read( rec );
+}
+
+// Look at the next record without taking it out.
+bool SessionReplayer::peek( sessionRecord_t *rec )
+{
+  if ( !replaying ) return false;
+  if ( !hasLookahead ) {
+    if ( !read( &lookahead ) ) return false;
+    hasLookahead = true;
+  }
+  *rec = lookahead;
+  return true;
+}
@@ -0,0 +1,100 @@
+// sessionRecorder
+
+/*
+  sessionRecorder.h
+    Records the traffic of a session to the micro SD card, and reads it back for the replay.
+    The records are stored in a ring buffer and written out to the file from loop() a little at a time.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -File format (little endian)
+  header  "CLCR" version(uint16) reserved(uint16)
+  record  time(uint32, ms from the beginning) type(uint8) length(uint8) data(length bytes)
+*/
+
+#ifndef SESSIONRECORDER_H
+#define SESSIONRECORDER_H
+
+#include <M5Stack.h>
+
+#define REC_USB_IN      1   // Frame received from the lens controller. (without '#')
+#define REC_USB_OUT     2   // Command sent to the lens controller.
+#define REC_BT_IN       3   // Frame received from the Bluetooth serial. (without '#')
+#define REC_BT_OUT      4   // Message sent to the Bluetooth serial.
+#define REC_KEY         5   // Key event. (keyEvent_t)
+#define REC_ENCODER     6   // Position of the faces encoder. (int16_t)
+#define REC_PHASE       7   // Phase of the state machine changed. (uint8_t)
+#define REC_CONNECT     8   // The lens controller or the Bluetooth is connected. (uint8_t 'U' or 'B')
+#define REC_STATE       9   // State at the beginning. (phase, lensIndex, apertureIndex, focusPosition, remoconMode as int32_t)
+#define REC_KEYMASK     10  // Buttons held down. (uint8_t KEYBIT_*)
+#define REC_CONTROLLER  11  // The lens controller of the following USB records. (uint8_t, 0 if not recorded)
+#define REC_BT_END      12  // End of the frames of the Bluetooth serial read by one perser. (no data)
+
+#define REC_VERSION     1
+#define REC_HEADERSIZE  8
+#define REC_MAXDATA     64    // max length of the data of one record
+#define REC_RINGSIZE    4096  // size of the ring buffer
+#define REC_FLUSHSIZE   512   // bytes written to the file at once
+#define REC_FLUSHMS     1000  // the ring buffer is written out at least this interval
+
+typedef struct {
+  uint32_t time;
+  uint8_t type;
+  uint8_t length;
+  uint8_t data[REC_MAXDATA + 1];  // The data is terminated by '\0' for the frames.
+} sessionRecord_t;
+
+class SessionRecorder
+{
+private:
+  File file;
+  bool recording;
+  unsigned long startTime;
+  unsigned long flushTime;
+  uint8_t ring[REC_RINGSIZE];
+  int ringHead;
+  int ringCount;
+
+  void put( const void *data, int length );
+
+public:
+  SessionRecorder();
+  ~SessionRecorder();
+
+  unsigned long records;
+  unsigned long overflow;   // Records lost because the ring buffer was full.
+
+  bool begin( fs::FS &fs, const char *path );
+  void end( void );
+  bool isRecording( void );
+  void record( uint8_t type, const void *data, int length );
+  void record( uint8_t type, const char *str );
+  void flush( bool force );
+};
+
+class SessionReplayer
+{
+private:
+  File file;
+  bool replaying;
+  bool hasLookahead;
+  sessionRecord_t lookahead;
+
+  bool read( sessionRecord_t *rec );
+
+public:
+  SessionReplayer();
+  ~SessionReplayer();
+
+  bool begin( fs::FS &fs, const char *path );
+  void end( void );
+  bool isReplaying( void );
+  bool next( sessionRecord_t *rec );
+  bool peek( sessionRecord_t *rec );
+};
+
+#endif  /* SESSIONRECORDER_H */
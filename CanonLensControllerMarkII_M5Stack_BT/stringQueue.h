@@ -25,6 +25,7 @@ class StringQueue {
       delete[] _data;  
     }
     inline int count();
+    inline bool isFull();
     inline int front();
     inline int back();
     void push(const String &item);
@@ -38,6 +39,11 @@ inline int StringQueue::count()
   return _count;
 }
 
+inline bool StringQueue::isFull() 
+{
+  return _count >= _maxitems;
+}
+
 inline int StringQueue::front() 
 {
   return _front;
@@ -0,0 +1,218 @@
+// timerWheel
+
+/*
+  timerWheel.cpp
+    TimerWheel hashes the timers to the slots by the due time, and runs the slots of the ticks passed.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include "timerWheel.h"
+
+// TimerWheel class constructor.
+TimerWheel::TimerWheel()
+{
+  for ( int i = 0; i < TIMER_MAX; i++ ) {
+    timer[i].active = false;
+    timer[i].firing = false;
+    timer[i].wheelSlot = TIMER_NONE;
+  }
+  for ( int s = 0; s < TIMER_SLOTS; s++ ) {
+    slot[s] = TIMER_NONE;
+  }
+  tick = 0;
+  started = false;
+  memset( &stat, 0, sizeof( stat ) );
+}
+
+// TimerWheel class destructor.
+TimerWheel::~TimerWheel()
+{
+}
+
+// Returns true if the <time> has come at the <now>.
+bool TimerWheel::isDue( unsigned long now, unsigned long time )
+{
+  return (long)( now - time ) >= 0;
+}
+
+// Start the timer. The handler is called after <delayMs>, and then every <periodMs> if it is not 0.
+// Returns the id of the timer, or TIMER_NONE if all of the timers are used.
+int TimerWheel::start( const char *name, unsigned long delayMs, unsigned long periodMs, timerHandler_t handler, void *arg )
+{
+  int id;
+  for ( id = 0; id < TIMER_MAX; id++ ) {
+    if ( !timer[id].active ) break;
+  }
+  if ( id >= TIMER_MAX ) {
+    stat.exhausted++;
+    return TIMER_NONE;
+  }
+  unsigned long now = millis();
+  if ( !started ) {
+    tick = now;
+    started = true;
+  }
+  timerEntry_t *t = &timer[id];
+  t->name = name;
+  t->handler = handler;
+  t->arg = arg;
+  t->due = now + delayMs;
+  t->period = periodMs;
+  t->active = true;
+  t->firing = false;
+  t->fired = 0;
+  t->lateMax = 0;
+  link( id );
+  return id;
+}
+
+int TimerWheel::once( const char *name, unsigned long delayMs, timerHandler_t handler, void *arg )
+{
+  return start( name, delayMs, 0, handler, arg );
+}
+
+int TimerWheel::every( const char *name, unsigned long periodMs, timerHandler_t handler, void *arg )
+{
+  return start( name, periodMs, periodMs, handler, arg );
+}
+
+// Stop the timer. It can be called from the handler.
+void TimerWheel::stop( int id )
+{
+  if ( id < 0 || id >= TIMER_MAX || !timer[id].active ) return;
+  unlink( id );
+  timer[id].active = false;
+  timer[id].firing = false;
+}
+
+bool TimerWheel::isActive( int id )
+{
+  return id >= 0 && id < TIMER_MAX && timer[id].active;
+}
+
+// Put the timer to the slot of the due time.
+// The time already passed goes to the next slot to be looked at.
+void TimerWheel::link( int id )
+{
+  timerEntry_t *t = &timer[id];
+  unsigned long time = isDue( tick, t->due ) ? tick : t->due;
+  int s = ( time / TIMER_TICKMS ) % TIMER_SLOTS;
+  t->next = slot[s];
+  t->wheelSlot = s;
+  slot[s] = id;
+}
+
+void TimerWheel::unlink( int id )
+{
+  timerEntry_t *t = &timer[id];
+  if ( t->wheelSlot == TIMER_NONE ) return;
+  int8_t *p = &slot[t->wheelSlot];
+  while ( *p != TIMER_NONE ) {
+    if ( *p == id ) {
+      *p = t->next;
+      break;
+    }
+    p = &timer[*p].next;
+  }
+  t->wheelSlot = TIMER_NONE;
+}
+
+/*************************************************************************
+ * NAME  update -
+ *
+ * SYNOPSIS
+ *
+ *    void TimerWheel::update( unsigned long now )
+ *
+ * DESCRIPTION
+ *  Look at the slots of the ticks from the last call to the <now>, and call
+ *  the handlers of the timers due. If the loop was late more than one turn,
+ *  every slot is looked at once. The timers due in a slot are taken out first,
+ *  so the handlers can start and stop any timer.
+ *************************************************************************/
+void TimerWheel::update( unsigned long now )
+{
+  int8_t due[TIMER_MAX];
+  int nSlot = 0;
+
+  if ( !started ) {
+    tick = now;
+    started = true;
+  }
+  while ( isDue( now, tick ) && nSlot < TIMER_SLOTS ) {
+    int s = ( tick / TIMER_TICKMS ) % TIMER_SLOTS;
+    tick += TIMER_TICKMS;   // The timers started by the handlers go to the next slot.
+    nSlot++;
+    if ( slot[s] == TIMER_NONE ) continue;
+
+    int nDue = 0;
+    int id = slot[s];
+    while ( id != TIMER_NONE ) {
+      int next = timer[id].next;
+      if ( isDue( now, timer[id].due ) ) {  // The others are of the later turn.
+        unlink( id );
+        timer[id].firing = true;
+        due[nDue++] = id;
+      }
+      id = next;
+    }
+    for ( int i = 0; i < nDue; i++ ) {
+      if ( timer[due[i]].firing ) {   // Not stopped by the handler before.
+        fire( due[i], now );
+      }
+    }
+  }
+  if ( isDue( now, tick ) ) {
+    tick = now + TIMER_TICKMS;  // Every slot has been looked at.
+  }
+}
+
+// Call the handler of the timer. The periodic timer is linked again before the call.
+void TimerWheel::fire( int id, unsigned long now )
+{
+  timerEntry_t *t = &timer[id];
+  timerHandler_t handler = t->handler;
+  void *arg = t->arg;
+  unsigned long late = now - t->due;
+
+  t->firing = false;
+  t->fired++;
+  if ( late > t->lateMax ) t->lateMax = late;
+  stat.fired++;
+  stat.lateTotal += late;
+  if ( late > stat.lateMax ) stat.lateMax = late;
+
+  if ( t->period > 0 ) {
+    t->due += t->period;
+    while ( (long)( now - t->due ) > 0 ) {  // The periods passed while the loop was late.
+      t->due += t->period;
+      stat.skipped++;
+    }
+    link( id );
+  } else {
+    t->active = false;
+  }
+
+  unsigned long startUs = micros();
+  handler( arg );
+  unsigned long handlerUs = micros() - startUs;
+  if ( handlerUs > stat.handlerUsMax ) stat.handlerUsMax = handlerUs;
+}
+
+// Print the lateness statistics to the serial.
+void TimerWheel::report( void )
+{
+  Serial.printf( "timer fired=%lu late avg=%lums max=%lums skipped=%lu exhausted=%lu handler max=%luus\n",
+                 stat.fired, stat.fired ? stat.lateTotal / stat.fired : 0, stat.lateMax,
+                 stat.skipped, stat.exhausted, stat.handlerUsMax );
+  for ( int i = 0; i < TIMER_MAX; i++ ) {
+    if ( !timer[i].active ) continue;
+    Serial.printf( "  %-12s period=%lums fired=%lu late max=%lums\n",
+                   timer[i].name, timer[i].period, timer[i].fired, timer[i].lateMax );
+  }
+}
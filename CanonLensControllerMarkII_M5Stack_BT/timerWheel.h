@@ -0,0 +1,91 @@
+// timerWheel
+
+/*
+  timerWheel.h
+    The cooperative scheduler of the timed work, driven by loop().
+    The timers are hashed to the slots of a wheel by the due time, one slot for each tick,
+    so update() looks at only the slots of the ticks passed since the last call.
+    A timer longer than one turn of the wheel stays in the slot until the turn of its due time.
+    The times are compared by the difference, so the wrap around of millis() is harmless.
+    The handler is called from update(), it must return without waiting. The wait is another timer.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  once()      Start the one-shot timer.
+  every()     Start the periodic timer. The first call is after the period.
+  start()     Start the timer with the first delay and the period. (period 0 is one-shot)
+  stop()      Stop the timer.
+  update()    Call the handlers of the timers due. Call it from loop().
+  isDue()     Compare the times, wrap-safe.
+  report()    Print the lateness statistics to the serial.
+*/
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <Arduino.h>
+
+#define TIMER_MAX       16    // number of the timers
+#define TIMER_SLOTS     64    // slots of the wheel (one turn is TIMER_SLOTS * TIMER_TICKMS)
+#define TIMER_TICKMS    1     // time of one slot (power of 2, for the wrap around)
+#define TIMER_NONE      -1
+
+typedef void ( *timerHandler_t )( void *arg );
+
+typedef struct {
+  const char *name;
+  timerHandler_t handler;
+  void *arg;
+  unsigned long due;          // millis() of the next call
+  unsigned long period;       // 0 is one-shot
+  int8_t next;                // next timer in the same slot
+  int8_t wheelSlot;           // slot linked, or TIMER_NONE
+  bool active;
+  bool firing;                // Taken out of the slot to be called.
+  unsigned long fired;
+  unsigned long lateMax;      // max time from the due to the call (ms)
+} timerEntry_t;
+
+typedef struct {
+  unsigned long fired;        // Handlers called.
+  unsigned long lateTotal;    // Total time from the due to the call. (ms)
+  unsigned long lateMax;
+  unsigned long skipped;      // Periods of the periodic timers skipped because the loop was late.
+  unsigned long exhausted;    // start() failed because all of the timers are used.
+  unsigned long handlerUsMax; // Longest handler.
+} timerStat_t;
+
+class TimerWheel
+{
+private:
+  timerEntry_t timer[TIMER_MAX];
+  int8_t slot[TIMER_SLOTS];
+  unsigned long tick;         // Time of the next slot to be looked at.
+  bool started;
+
+  void link( int id );
+  void unlink( int id );
+  void fire( int id, unsigned long now );
+
+public:
+  TimerWheel();
+  ~TimerWheel();
+
+  timerStat_t stat;
+
+  int start( const char *name, unsigned long delayMs, unsigned long periodMs, timerHandler_t handler, void *arg );
+  int once( const char *name, unsigned long delayMs, timerHandler_t handler, void *arg );
+  int every( const char *name, unsigned long periodMs, timerHandler_t handler, void *arg );
+  void stop( int id );
+  bool isActive( int id );
+  void update( unsigned long now );
+  void report( void );
+  static bool isDue( unsigned long now, unsigned long time );
+};
+
+#endif  /* TIMERWHEEL_H */
@@ -0,0 +1,177 @@
+// tokenizer
+
+/*
+  tokenizer.cpp
+    Tokenizer walks the separators of the string, and parses the numbers straight from the views.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+*/
+
+#include <limits.h>
+#include "tokenizer.h"
+
+// Tokenizer class constructor.
+// When <skipEmpty>, the separators in a row are taken as one. (the list separated by spaces)
+// Otherwise every separator ends a field, and the empty fields are returned too.
+Tokenizer::Tokenizer( const char *str, char separator, bool skipEmpty )
+{
+  this->ptr = str;
+  this->end = str + strlen( str );
+  this->separator = separator;
+  this->skipEmpty = skipEmpty;
+  this->done = ( ptr == end );
+}
+
+Tokenizer::Tokenizer( const char *str, int length, char separator, bool skipEmpty )
+{
+  this->ptr = str;
+  this->end = str + length;
+  this->separator = separator;
+  this->skipEmpty = skipEmpty;
+  this->done = ( ptr == end );
+}
+
+// Tokenizer class destructor.
+Tokenizer::~Tokenizer()
+{
+}
+
+// Take out the next token. Returns false when no token is left.
+bool Tokenizer::next( tokenView_t *token )
+{
+  if ( done ) return false;
+  if ( skipEmpty ) {
+    while ( ptr < end && *ptr == separator ) ptr++;
+    if ( ptr == end ) {
+      done = true;
+      return false;
+    }
+  }
+  const char *s = ptr;
+  while ( ptr < end && *ptr != separator ) ptr++;
+  token->ptr = s;
+  token->length = ptr - s;
+  if ( ptr == end ) {
+    done = true;
+  } else {
+    ptr++;    // Skip the separator.
+  }
+  return true;
+}
+
+// Take out the next token as an integer.
+// Returns false when no token is left or the token is not an integer.
+bool Tokenizer::nextInt( int *value )
+{
+  tokenView_t token;
+  if ( !next( &token ) ) return false;
+  return parseInt( &token, value );
+}
+
+// Take out the next token as a fixed point number of <decimals> digits.
+bool Tokenizer::nextFixed( int *value, int decimals )
+{
+  tokenView_t token;
+  if ( !next( &token ) ) return false;
+  return parseFixed( &token, decimals, value );
+}
+
+// Returns true when no token is left.
+bool Tokenizer::atEnd( void )
+{
+  Tokenizer rest = *this;
+  tokenView_t token;
+  return !rest.next( &token );
+}
+
+// Count the rest of the tokens. The position is not changed.
+int Tokenizer::count( void )
+{
+  Tokenizer rest = *this;
+  tokenView_t token;
+  int n = 0;
+  while ( rest.next( &token ) ) n++;
+  return n;
+}
+
+// Parse the decimal integer of the <token>. An optional sign and one or more digits.
+// Returns false for an empty token, any other character, or the overflow of int.
+// The <value> is not changed when false is returned.
+bool Tokenizer::parseInt( const tokenView_t *token, int *value )
+{
+  const char *p = token->ptr;
+  const char *e = p + token->length;
+  bool negative = false;
+
+  if ( p < e && ( *p == '-' || *p == '+' ) ) negative = ( *p++ == '-' );
+  if ( p == e ) return false;
+  long long n = 0;
+  while ( p < e ) {
+    if ( !isdigit( *p ) ) return false;
+    n = n * 10 + ( *p++ - '0' );
+    if ( n > (long long)INT_MAX + 1 ) return false;
+  }
+  if ( negative ) n = -n;
+  if ( n > INT_MAX || n < INT_MIN ) return false;
+  *value = (int)n;
+  return true;
+}
+
+bool Tokenizer::parseInt( const char *str, int *value )
+{
+  tokenView_t token = { str, (int)strlen( str ) };
+  return parseInt( &token, value );
+}
+
+// Parse the fixed point number of the <token> as an integer of <decimals> digits below the point.
+// "2.8" -> 28, "8" -> 80, "1.25" -> 12 (with 1 decimal, the rest of the digits are cut off)
+// Returns false for an empty token, any other character, two points, or the overflow of int.
+bool Tokenizer::parseFixed( const tokenView_t *token, int decimals, int *value )
+{
+  const char *p = token->ptr;
+  const char *e = p + token->length;
+  bool negative = false;
+  bool point = false;
+  int digits = 0;
+  int fraction = 0;
+
+  if ( p < e && ( *p == '-' || *p == '+' ) ) negative = ( *p++ == '-' );
+  long long n = 0;
+  for ( ; p < e; p++ ) {
+    if ( *p == '.' ) {
+      if ( point ) return false;
+      point = true;
+      continue;
+    }
+    if ( !isdigit( *p ) ) return false;
+    digits++;
+    if ( point ) {
+      if ( fraction >= decimals ) continue;
+      fraction++;
+    }
+    n = n * 10 + ( *p - '0' );
+    if ( n > INT_MAX ) return false;
+  }
+  if ( digits == 0 ) return false;
+  for ( ; fraction < decimals; fraction++ ) {
+    n *= 10;
+    if ( n > INT_MAX ) return false;
+  }
+  *value = (int)( negative ? -n : n );
+  return true;
+}
+
+// Make a String of the <token>. This is the only function that allocates.
+String Tokenizer::toString( const tokenView_t *token )
+{
+  String str;
+  str.reserve( token->length );
+  for ( int i = 0; i < token->length; i++ ) {
+    str += token->ptr[i];
+  }
+  return str;
+}
@@ -0,0 +1,60 @@
+// tokenizer
+
+/*
+  tokenizer.h
+    Splits a string into the tokens without copying it.
+    A token is a view (pointer and length) into the original string, so the string must be kept
+    while the tokens are used. The integer and the fixed point numbers are parsed from the view
+    directly, and a malformed field is reported instead of being taken as 0.
+
+  Copyright (C) 2026 by bergamot-jellybeans.
+
+  Date-written. Oct 18,2026.
+  Last-modify.  Oct 18,2026.
+  mailto:   bergamot.jellybeans@icloud.com
+
+  -Overview of the functions
+  next()        Take out the next token.
+  nextInt()     Take out the next token as an integer.
+  nextFixed()   Take out the next token as a fixed point number. ("2.8" -> 28 with 1 decimal)
+  count()       Count the rest of the tokens.
+  parseInt()    Parse an integer of the view. (also for a whole string)
+  parseFixed()  Parse a fixed point number of the view.
+*/
+
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <Arduino.h>
+
+typedef struct {
+  const char *ptr;
+  int length;
+} tokenView_t;
+
+class Tokenizer
+{
+private:
+  const char *ptr;
+  const char *end;
+  char separator;
+  bool skipEmpty;
+  bool done;
+
+public:
+  Tokenizer( const char *str, char separator, bool skipEmpty = true );
+  Tokenizer( const char *str, int length, char separator, bool skipEmpty = true );
+  ~Tokenizer();
+
+  bool next( tokenView_t *token );
+  bool nextInt( int *value );
+  bool nextFixed( int *value, int decimals );
+  bool atEnd( void );
+  int count( void );
+  static bool parseInt( const tokenView_t *token, int *value );
+  static bool parseInt( const char *str, int *value );
+  static bool parseFixed( const tokenView_t *token, int decimals, int *value );
+  static String toString( const tokenView_t *token );
+};
+
+#endif  /* TOKENIZER_H */